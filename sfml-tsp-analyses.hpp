@@ -154,84 +154,201 @@ public:
 };
 
 
-TSPSplitRoute * TSPRouteAnalyzer::findIntersections(TSPRoute * r) {
-	int n=0;
-	int bestI = -1;
-	int bestJ = -1;
-	double bestReduction = 0.0;
-
-	// i -> all segments
-	for (size_t i=0; i<r->getSize(); i++) {
-		int idxA = r->getStep(i);
-		int idxB = r->getStep(i+1); // this wraps around at the end
-
-		// j -> all segments
-		for (size_t j=i+2; j<r->getSize(); j++) {
-			if (i == 0 && j == r->getSize()-1) continue;
-			if (i == 0 && j == r->getSize()-2) continue;
-			if (i == 1 && j == r->getSize()-1) continue;
-			// if (i+1==j || i==j || i==j+1) continue; // ignore the very same segment
-			// also, adjoining segments should never overlap.
-			// For routes between 2 points things look grim,
-			// but let's ignore that for now.
-			int idxC = r->getStep(j);
-			int idxD = r->getStep(j+1); // this wraps around at the end
-
-			sf::Vector2<double> a(points[idxA].getX(), points[idxA].getY());
-			sf::Vector2<double> b(points[idxB].getX(), points[idxB].getY());
-			sf::Vector2<double> c(points[idxC].getX(), points[idxC].getY());
-			sf::Vector2<double> d(points[idxD].getX(), points[idxD].getY());
-
-			LinearEquation le(a, b, c, d);
-
-			if (!le.hasIntersection()) continue;
-
-			sf::Vector2<double> intersection = le.getIntersection();
-			if (le.isPointOnLineAB(intersection) && le.isPointOnLineCD(intersection)) {
-				n++;
-
-				// compare length of AB + CD to AD + BC:
-				double ab = routingTable->getDistance(idxA, idxB);
-				double cd = routingTable->getDistance(idxC, idxD);
-
-				double ac = routingTable->getDistance(idxA, idxC);
-				double bd = routingTable->getDistance(idxB, idxD);
+/**
+ * finds the intersection of two route segments whose removal saves the most.
+ * Each segment is tested against all later ones in one pass of the batched
+ * kernel simdSegmentsCross(); only nearly collinear cases need the exact predicate.
+ * @param split if not NULL, receives the route split at that intersection, part B already reversed
+ * @param pool if not NULL, the segments are distributed over its threads
+ * @param deadline if not NULL and expired, the scan stops early (with the best crossing so far)
+ * @param examined if not NULL, the number of segment pairs looked at is added to it
+ * @return true if any intersection was found
+ */
+bool TSPRouteAnalyzer::findIntersections(TSPRoute * r, TSPSplitRoute * split, TSPThreadPool * pool, const TSPDeadline * deadline, long long * examined) {
+	TSP_ZONE("findIntersections");
+	// the route's coordinates in order, the first point repeated at the end (reused, no allocation per call):
+	size_t size = r->getSize();
+	static thread_local vector<double> routeXs, routeYs;
+	vector<double> & xs = routeXs, & ys = routeYs; // references, so that the worker threads see this thread's copies
+	xs.resize(size + 1); ys.resize(size + 1);
+	for (size_t i=0; i<=size; i++) {
+		xs[i] = points.getX(r->getStep(i)); // this wraps around at the end
+		ys[i] = points.getY(r->getStep(i));
+	}
+	if (size < 4) return false;
+
+	// i -> all segments (in parallel, if a pool is given)
+	atomic<long long> pairs(0);
+	TSPScanBest best = parallelBest(pool, size - 2, size / 2, [&](size_t first, size_t last, TSPScanBest & b) {
+		static thread_local vector<unsigned char> result;
+		result.resize(size);
+		for (size_t i=first; i<last; i++) {
+			if (deadline != NULL && deadline->expired()) break;
+			// j -> all later segments, except the one adjoining segment i at the end of the route:
+			size_t from = i + 2;
+			size_t to = (i == 0) ? size - 1 : size;
+			if (from >= to) continue;
+			pairs += to - from;
+			simdSegmentsCross(xs[i], ys[i], xs[i+1], ys[i+1],
+				&xs[from], &ys[from], &xs[from+1], &ys[from+1], to - from, &result[0]);
+
+			for (size_t j=from; j<to; j++) {
+				unsigned char cross = result[j - from];
+				if (cross == SEGMENTS_APART) continue;
+				if (cross == SEGMENTS_UNSURE && !segmentsCross(xs[i], ys[i], xs[i+1], ys[i+1], xs[j], ys[j], xs[j+1], ys[j+1])) continue;
+
+				// compare length of AB + CD to AC + BD (from the coordinates: the distance cache is not thread-safe):
+				double ab = hypot(xs[i+1] - xs[i], ys[i+1] - ys[i]);
+				double cd = hypot(xs[j+1] - xs[j], ys[j+1] - ys[j]);
+				double ac = hypot(xs[j] - xs[i], ys[j] - ys[i]);
+				double bd = hypot(xs[j+1] - xs[i+1], ys[j+1] - ys[i+1]);
 
 				double reduction = (ab+cd) - (ac+bd);
+				if (reduction > b.gain) {
+					b.gain = reduction;
+					b.i = i;
+					b.j = j;
+				}
+			} // next j
+		} // next i
+	});
+	if (examined != NULL) *examined += pairs;
+
+	if (best.i >= 0) {
+		// most savings can be achieved by swapping AB and CD into AC and BD:
+		if (split != NULL) {
+			split->assign(r, best.i, best.j);
+			split->reverseB();
+		}
+		return true;
+	}
 
-				// cout << "Segment " << i << " intersects with seg. " << j << ": ";
-				// cout << "AB (" << idxA << "-" << idxB << ") and ";
-				// cout << "CD (" << idxC << "-" << idxD << "), ";
-				// cout << "l=" << (ab+cd) << " vs. " << (ac+bd) << " (minus " << reduction <<  ")" << endl;
+	return false;
+}
 
-				if (reduction > bestReduction) {
-					bestI = i;
-					bestJ = j;
-					bestReduction = reduction;
-				}
-			}
 
-		} // next j
-	} // next i
+/**
+ * true if AB and CD properly cross each other (touching at an end point, or
+ * overlapping collinearly, does not count). Exact, see sfml-tsp-geometry.hpp.
+ */
+bool TSPRouteAnalyzer::segmentsCross(double ax, double ay, double bx, double by, double cx, double cy, double dx, double dy) {
+	return segmentsCrossExact(ax, ay, bx, by, cx, cy, dx, dy);
+}
 
-	if (n>0) {
-		int idxA = r->getStep(bestI);
-		int idxB = r->getStep(bestI+1); // this wraps around at the end
-		int idxC = r->getStep(bestJ);
-		int idxD = r->getStep(bestJ+1); // this wraps around at the end
-		cout << "Most savings (" << bestReduction << ") can be achieved by swapping ";
-		cout << "AB (" << idxA << "-" << idxB << ") and ";
-		cout << "CD (" << idxC << "-" << idxD << ") into ";
-		cout << "AC (" << idxA << "-" << idxC << ") and ";
-		cout << "BD (" << idxB << "-" << idxD << ")" << endl;
+/**
+ * finds all crossings of the route: every segment is put into the cells of a
+ * uniform grid (about n cells) which it passes through (clipped column by
+ * column, so long segments of random or tangled routes don't fill their whole
+ * bounding box), and only segments sharing a cell are compared. Every segment
+ * looks at the later ones in its cells, a stamp per segment skips the pairs
+ * seen in an earlier cell already. This is about O(n + E + k), E being the
+ * number of cell entries (about n for good routes, n^1.5 for random ones).
+ * @return the number of crossings (k)
+ */
+size_t TSPRouteAnalyzer::findAllCrossings(TSPRoute * r, vector<TSPCrossing> & out) {
+	out.clear();
+	size_t n = r->getSize();
+	if (n < 4) return 0;
+
+	// reused, no allocation per call:
+	static thread_local vector<double> sx0, sy0, sx1, sy1; // bounding boxes
+	static thread_local vector<int> cellStart, cellItems, fill, seen, cells;
+	sx0.resize(n); sy0.resize(n); sx1.resize(n); sy1.resize(n);
+
+	double minX = 0, minY = 0, maxX = 0, maxY = 0;
+	for (size_t i=0; i<n; i++) {
+		int a = r->getStep(i), b = r->getStep(i+1);
+		sx0[i] = min(points.getX(a), points.getX(b)); sx1[i] = max(points.getX(a), points.getX(b));
+		sy0[i] = min(points.getY(a), points.getY(b)); sy1[i] = max(points.getY(a), points.getY(b));
+		if (i == 0 || sx0[i] < minX) minX = sx0[i];
+		if (i == 0 || sx1[i] > maxX) maxX = sx1[i];
+		if (i == 0 || sy0[i] < minY) minY = sy0[i];
+		if (i == 0 || sy1[i] > maxY) maxY = sy1[i];
+	}
 
-		TSPSplitRoute * split = new TSPSplitRoute(r, bestI, bestJ);
-		split->reverseB();
-		cout << split->describe();
-		return split;
+	int g = (int)ceil(sqrt((double)n));
+	double cellW = (maxX - minX) / g; if (cellW <= 0) cellW = 1;
+	double cellH = (maxY - minY) / g; if (cellH <= 0) cellH = 1;
+	auto cellX = [&](double x) { int c = (int)((x - minX) / cellW); return (c >= g) ? g-1 : ((c < 0) ? 0 : c); };
+	auto cellY = [&](double y) { int c = (int)((y - minY) / cellH); return (c >= g) ? g-1 : ((c < 0) ? 0 : c); };
+
+	// the cells which segment i passes through: per column, the rows between
+	// the y of the segment at both sides of the column (with a little margin,
+	// so that rounding never loses a cell of a crossing)
+	double margin = cellH * 1e-6;
+	auto findCells = [&](size_t i) {
+		cells.clear();
+		int a = r->getStep(i), b = r->getStep(i+1);
+		double ax = points.getX(a), ay = points.getY(a), bx = points.getX(b), by = points.getY(b);
+		if (ax > bx) { swap(ax, bx); swap(ay, by); }
+		int x0 = cellX(ax), x1 = cellX(bx);
+		for (int x=x0; x<=x1; x++) {
+			double yl = ay, yr = by;
+			if (x0 < x1) {
+				double l = (x == x0) ? ax : minX + x * cellW;
+				double rr = (x == x1) ? bx : minX + (x+1) * cellW;
+				yl = ay + (l - ax) * (by - ay) / (bx - ax);
+				yr = ay + (rr - ax) * (by - ay) / (bx - ax);
+			}
+			int y0 = cellY(min(yl, yr) - margin), y1 = cellY(max(yl, yr) + margin);
+			for (int y=y0; y<=y1; y++) cells.push_back(y*g + x);
+		}
+	};
+
+	// counting sort of the segments into the cells they pass through:
+	cellStart.assign(g*g + 1, 0);
+	for (size_t i=0; i<n; i++) {
+		findCells(i);
+		for (size_t m=0; m<cells.size(); m++) cellStart[cells[m] + 1] ++;
 	}
+	for (int c=0; c<g*g; c++) cellStart[c+1] += cellStart[c];
+	cellItems.resize(cellStart[g*g]);
+	fill.assign(cellStart.begin(), cellStart.end() - 1);
+	for (size_t i=0; i<n; i++) {
+		findCells(i);
+		for (size_t m=0; m<cells.size(); m++) cellItems[fill[cells[m]]++] = i;
+	}
+
+	seen.assign(n, -1); // seen[j] == i: the pair (i, j) has been compared already
+	for (size_t i=0; i<n; i++) {
+		findCells(i);
+		for (size_t m=0; m<cells.size(); m++) {
+			int c = cells[m];
+			for (int q=cellStart[c]; q<cellStart[c+1]; q++) {
+				int j = cellItems[q];
+				if (j <= (int)i || seen[j] == (int)i) continue;
+				seen[j] = i;
+				// neighbouring segments share a point:
+				if (j - (int)i == 1 || j - (int)i == (int)n-1) continue;
+				// bounding boxes:
+				if (sx0[i] > sx1[j] || sx0[j] > sx1[i] || sy0[i] > sy1[j] || sy0[j] > sy1[i]) continue;
+
+				int a = r->getStep(i), b = r->getStep(i+1);
+				int cc = r->getStep(j), d = r->getStep(j+1);
+				double ax = points.getX(a), ay = points.getY(a), bx = points.getX(b), by = points.getY(b);
+				double cx = points.getX(cc), cy = points.getY(cc), dx = points.getX(d), dy = points.getY(d);
+				if (!segmentsCross(ax, ay, bx, by, cx, cy, dx, dy)) continue;
+
+				TSPCrossing x;
+				x.i = i;
+				x.j = j;
+				// intersection point (for display only):
+				double t = ((cx - ax) * (dy - cy) - (cy - ay) * (dx - cx)) / ((bx - ax) * (dy - cy) - (by - ay) * (dx - cx));
+				x.x = ax + t * (bx - ax);
+				x.y = ay + t * (by - ay);
+				out.push_back(x);
+			}
+		}
+	}
+	return out.size();
+}
 
-	return NULL;
+/**
+ * quick quality check of a route: a good route has no crossings at all.
+ */
+size_t TSPRouteAnalyzer::countCrossings(TSPRoute * r) {
+	static thread_local vector<TSPCrossing> crossings;
+	return findAllCrossings(r, crossings);
 }
 
 
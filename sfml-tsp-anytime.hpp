@@ -0,0 +1,172 @@
+#ifndef TSP_ANYTIME
+#define TSP_ANYTIME 1
+
+#include <functional>
+
+#define ANYTIME_SECONDS 0.2 // default deadline of the A key (Shift: ten times as long)
+#define ANYTIME_KICK_SPAN 50 // max. length of each of the two segments which a kick exchanges
+#define ANYTIME_KICK_MIN_N 8 // fewer points: no kicks, the first local optimum is the answer
+
+using namespace std;
+
+
+/////////////////////////////////////////////////////////////////////////////
+//                                                                         //
+// CLASSES AND METHODS:                                                    //
+//                                                                         //
+/////////////////////////////////////////////////////////////////////////////
+
+/**
+ * how TSPAnytimeSolver::solve() builds its first route (if it is not given one)
+ */
+enum TSPConstruction {
+    CONSTRUCT_AUTO = 0, // solveSmall() for up to SMALL_MAX_N points, otherwise CONSTRUCT_CLOSEST
+    CONSTRUCT_CLOSEST = 1, // TSPRouter::naiveClosest()
+    CONSTRUCT_RANDOM = 2, // TSPRouter::naiveRandom()
+    CONSTRUCT_PARTITION = 3 // TSPPartitionSolver
+};
+
+/**
+ * the best route that can be had within a wall-clock deadline and / or an
+ * evaluation budget: construction, then TSPRouteOptimizer::optimizeStep()
+ * until a local optimum, then kicks (two neighbouring segments of the best
+ * route exchanged, a "double bridge") with local search again, until the
+ * limits expire. The optimizer checks the limits inside its operator loops,
+ * so solve() returns shortly after the deadline; only the construction
+ * always runs to the end (without it there is no route at all).
+ */
+class TSPAnytimeSolver {
+    public:
+        /** gets every new best route; only valid during the call (copy it to keep it) */
+        typedef function<void(TSPRoute * best, double seconds)> Callback;
+    protected:
+        TSPRouteOptimizer * optimizer;
+        TSPThreadPool * pool;
+        TSPConstruction construction;
+        double target; // see setTarget()
+        TSPRandom random; // for the kicks, independent of globalRandom
+        int improvements;
+        int kicks;
+        string message;
+        TSPRoute * construct(void);
+        TSPRoute * kick(TSPRoute * r);
+    public:
+        TSPAnytimeSolver(TSPRouteOptimizer * optimizer, TSPThreadPool * pool = NULL, uint64_t seed = 1) : random(seed) {
+            this->optimizer = optimizer; this->pool = pool;
+            construction = CONSTRUCT_AUTO; target = -1; improvements = 0; kicks = 0;
+        }
+        void setConstruction(TSPConstruction c) { construction = c; }
+        void setTarget(double length) { target = length; } // solve() stops at this length, e.g. the lower bound plus TARGET_GAP (<= 0: none)
+        TSPRoute * solve(TSPRoute * start, double seconds, long long evaluations = -1, Callback onBest = Callback());
+        int getImprovements(void) { return improvements; }
+        int getKicks(void) { return kicks; }
+        string getMessage(void) { return message; }
+};
+
+TSPRoute * TSPAnytimeSolver::construct(void) {
+    size_t n = points.size();
+    TSPConstruction c = construction;
+    if (c == CONSTRUCT_AUTO) {
+        if (n <= SMALL_MAX_N) {
+            vector<int> seq(n);
+            solveSmall(points, NULL, n, seq.data());
+            TSPRoute * r = routePool->acquire();
+            for (size_t i=0; i<n; i++) r->addStep(seq[i]);
+            return r;
+        }
+        c = CONSTRUCT_CLOSEST;
+    }
+    switch (c) {
+        case CONSTRUCT_RANDOM: return TSPRouter::naiveRandom();
+        case CONSTRUCT_PARTITION: return TSPPartitionSolver(points, pool).solve();
+        default: return TSPRouter::naiveClosest();
+    }
+}
+
+/**
+ * exchanges the segments A (after a random position p) and B (right after A):
+ * ... p A B x ... becomes ... p B A x ...; three edges change, and the
+ * optimizer only has to look at their end points again.
+ * @return a new route (from the route pool)
+ */
+TSPRoute * TSPAnytimeSolver::kick(TSPRoute * r) {
+    int n = r->getSize();
+    int span = min(ANYTIME_KICK_SPAN, (n - 2) / 2);
+    int p = random.nextBelow(n);
+    int lengthA = 1 + random.nextBelow(span), lengthB = 1 + random.nextBelow(span);
+
+    // the rest first (it ends with p), so that A and B may wrap around the end of r:
+    TSPRoute * kicked = routePool->acquire();
+    int rest = n - lengthA - lengthB;
+    for (int k=0; k<rest; k++) kicked->addStep(r->getStep(p + lengthA + lengthB + 1 + k));
+    for (int k=0; k<lengthB; k++) kicked->addStep(r->getStep(p + lengthA + 1 + k));
+    for (int k=0; k<lengthA; k++) kicked->addStep(r->getStep(p + 1 + k));
+
+    int touched[6] = {
+        r->getStep(p), r->getStep(p + 1), r->getStep(p + lengthA),
+        r->getStep(p + lengthA + 1), r->getStep(p + lengthA + lengthB), r->getStep(p + lengthA + lengthB + 1)
+    };
+    optimizer->continueFrom(kicked, touched, 6);
+    return kicked;
+}
+
+/**
+ * @param start the route to improve (not changed), or NULL: construct one
+ * @param seconds the deadline, from now (< 0: none)
+ * @param evaluations the budget, in points looked at by the optimizer (< 0: none)
+ * @param onBest called with the first route and with every shorter one
+ * @return the best route found (from the route pool); with neither a
+ * deadline nor a budget, the first local optimum; the first route at or
+ * below the target (see setTarget()), if any
+ */
+TSPRoute * TSPAnytimeSolver::solve(TSPRoute * start, double seconds, long long evaluations, Callback onBest) {
+    TSP_ZONE("anytimeSolve");
+    chrono::steady_clock::time_point begin = chrono::steady_clock::now();
+    optimizer->setLimits(seconds, evaluations);
+    optimizer->setInPlace(true); // current is ours: no copy per move of a large route
+    bool tracing = optimizer->isTracing();
+    optimizer->setTracing(false); // a scratch search: only the result goes into the trace, by setCurrentRoute()
+    bool limited = (seconds >= 0 || evaluations >= 0);
+    improvements = 0; kicks = 0;
+
+    TSPRoute * best = (start != NULL) ? routePool->acquireCopy(start) : construct();
+    TSPRoute * current = best; // the one being optimized: best, or a kicked copy of it
+    double bestLength = best->getLength(); // (best may have been improved in place)
+    if (onBest) onBest(best, chrono::duration<double>(chrono::steady_clock::now() - begin).count());
+
+    while (!optimizer->isExpired() && !(target > 0 && bestLength <= target)) {
+        TSPRoute * better = optimizer->optimizeStep(current);
+        if (better != NULL) {
+            if (current != best && current != better) routePool->release(current);
+            current = better;
+            if (current->getLength() < bestLength - 1e-10) {
+                if (best != current) routePool->release(best);
+                best = current;
+                bestLength = best->getLength();
+                improvements ++;
+                if (onBest) onBest(best, chrono::duration<double>(chrono::steady_clock::now() - begin).count());
+            }
+            continue;
+        }
+        if (optimizer->isExpired()) break;
+
+        // a local optimum - best is one, too: kick it and search again
+        if (!limited || best->getSize() < ANYTIME_KICK_MIN_N) break;
+        if (current != best) routePool->release(current);
+        current = kick(best);
+        kicks ++;
+    }
+    if (current != best) routePool->release(current);
+
+    stringstream ss;
+    ss << "Anytime solver: " << best->getLength() << " after " << improvements << " improvements and " << kicks << " kicks, ";
+    ss << optimizer->getEvaluations() << " evaluations in " << chrono::duration<double>(chrono::steady_clock::now() - begin).count() << "s";
+    ss << ((target > 0 && bestLength <= target) ? ", target reached." : ".");
+    message = ss.str();
+    optimizer->clearLimits();
+    optimizer->setInPlace(false);
+    optimizer->setTracing(tracing);
+    return best;
+}
+
+#endif
@@ -0,0 +1,340 @@
+#ifndef TSP_BOUNDS
+#define TSP_BOUNDS 1
+
+#include <algorithm> // for std::sort()
+
+#define BOUND_ITERATIONS 1000 // max. subgradient steps
+#define BOUND_AUTO_MAX_N 500 // compute the lower bound at startup up to this many points (otherwise: key L)
+#define TARGET_GAP 0.005 // <Shift>+O stops as soon as the route is within 0.5% of the lower bound
+
+using namespace std;
+
+
+/////////////////////////////////////////////////////////////////////////////
+//                                                                         //
+// CLASSES AND METHODS:                                                    //
+//                                                                         //
+/////////////////////////////////////////////////////////////////////////////
+
+/**
+ * Held-Karp lower bound: a minimum 1-tree (spanning tree on points 1..n-1,
+ * plus the two cheapest edges of point 0) is never longer than the optimal
+ * route. Node penalties pi[] (edge cost d(i,j) + pi[i] + pi[j]) are tuned by
+ * subgradient optimization to push every degree towards 2, which raises the
+ * bound L(T) - 2*sum(pi).
+ * Up to MATRIX_MAX_N points the 1-trees are computed on the complete graph
+ * (dense Prim, O(n^2)) and the bound is exact; above, on the candidate graph
+ * only, so the result is an estimate. Without candidate lists (NULL), it is
+ * always dense.
+ */
+class TSPLowerBound {
+    protected:
+        TSPPointStore * points;
+        TSPDistanceProvider * dist;
+        TSPCandidateLists * cand;
+        size_t n;
+        bool dense; // complete graph (valid bound) or candidate graph (estimate)
+        vector<double> pi; // current penalties
+        vector<double> bestPi; // penalties of the best bound
+        vector<int> parent; // 1-tree: parent of each point (point 1 is the root, point 0 see special[])
+        vector<int> degree;
+        int special[2]; // the two neighbours of point 0
+        double bound;
+        bool tour; // true if the best 1-tree is a route (then the bound is optimal)
+        int iterations;
+        // scratch:
+        vector<double> key;
+        vector<double> row; // distances from one point to all others
+        vector<char> inTree;
+        vector<int> root;
+        struct Edge { double cost; int i, j; };
+        vector<Edge> edges;
+
+        double cost(int i, int j) { return dist->getDistance(i, j) + pi[i] + pi[j]; }
+        double denseTree(void);
+        double sparseTree(void);
+        int findRoot(int i);
+        double connectSpecial(void);
+    public:
+        TSPLowerBound(TSPPointStore & points, TSPDistanceProvider * dist, TSPCandidateLists * cand);
+        double compute(double upperBound, int maxIterations = BOUND_ITERATIONS);
+        double getBound(void) { return bound; }
+        bool isExact(void) { return dense; } // otherwise the bound may even exceed the optimum: never stop on it
+        bool isTour(void) { return tour; }
+        /**
+         * @return the relative distance of a route length to the bound, e.g. 0.01 = 1%, or -1 if unknown
+         */
+        double getGap(double length) { return (bound > 0) ? (length - bound) / bound : -1; }
+        const vector<double> & getPenalties(void) { return bestPi; }
+        void updateAlphaCandidates(TSPCandidateLists & c);
+        string debug(void);
+};
+
+TSPLowerBound::TSPLowerBound(TSPPointStore & points, TSPDistanceProvider * dist, TSPCandidateLists * cand) {
+    this->points = &points;
+    this->dist = dist;
+    this->cand = cand;
+    this->n = points.size();
+    this->dense = (n <= MATRIX_MAX_N || cand == NULL);
+    pi.assign(n, 0);
+    bestPi.assign(n, 0);
+    parent.assign(n, -1);
+    degree.assign(n, 0);
+    special[0] = -1; special[1] = -1;
+    bound = -1;
+    tour = false;
+    iterations = 0;
+}
+
+/**
+ * Prim on points 1..n-1 with the current penalties.
+ * @return the length (with penalties) of the spanning tree
+ */
+double TSPLowerBound::denseTree(void) {
+    key.assign(n, 1e300);
+    inTree.assign(n, 0);
+    row.resize(n);
+    double length = 0;
+    key[1] = 0;
+    parent[1] = -1;
+    for (size_t step=1; step<n; step++) {
+        int best = -1;
+        for (size_t i=1; i<n; i++) {
+            if (!inTree[i] && (best < 0 || key[i] < key[best])) best = i;
+        }
+        inTree[best] = 1;
+        length += key[best];
+        dist->fillDistances(best, 0, n, &row[0]); // in the metric of dist (Euclidean: SIMD, much faster than n calls of getDistance())
+        double piBest = pi[best];
+        for (size_t i=1; i<n; i++) {
+            if (inTree[i]) continue;
+            double c = row[i] + piBest + pi[i];
+            if (c < key[i]) { key[i] = c; parent[i] = best; }
+        }
+    }
+    return length;
+}
+
+int TSPLowerBound::findRoot(int i) {
+    while (root[i] != i) { root[i] = root[root[i]]; i = root[i]; }
+    return i;
+}
+
+/**
+ * Kruskal on the candidate edges between points 1..n-1. Should the candidate
+ * graph not be connected, the remaining parts are simply chained together.
+ */
+double TSPLowerBound::sparseTree(void) {
+    edges.clear();
+    for (size_t i=1; i<n; i++) {
+        const int * c = cand->getCandidates(i);
+        for (size_t m=0; m<cand->getK(); m++) {
+            int j = c[m];
+            if (j <= 0 || (size_t)j < i) continue; // without point 0, and each edge only once
+            Edge e = { cost(i, j), (int)i, j };
+            edges.push_back(e);
+        }
+        // the reverse direction, if i is not in j's list:
+        for (size_t m=0; m<cand->getK(); m++) {
+            int j = c[m];
+            if (j <= 0 || (size_t)j > i) continue;
+            const int * cj = cand->getCandidates(j);
+            bool listed = false;
+            for (size_t q=0; q<cand->getK(); q++) if ((size_t)cj[q] == i) listed = true;
+            if (!listed) { Edge e = { cost(i, j), j, (int)i }; edges.push_back(e); }
+        }
+    }
+    sort(edges.begin(), edges.end(), [](const Edge & a, const Edge & b) { return a.cost < b.cost; });
+
+    root.resize(n);
+    for (size_t i=0; i<n; i++) root[i] = i;
+    double length = 0;
+    size_t added = 0;
+    for (size_t e=0; e<edges.size() && added < n-2; e++) {
+        int a = findRoot(edges[e].i), b = findRoot(edges[e].j);
+        if (a == b) continue;
+        root[a] = b;
+        degree[edges[e].i] ++;
+        degree[edges[e].j] ++;
+        length += edges[e].cost;
+        added ++;
+    }
+    // disconnected candidate graph:
+    int last = -1;
+    for (size_t i=1; i<n && added < n-2; i++) {
+        int r = findRoot(i);
+        if ((size_t)r != i) continue;
+        if (last >= 0) {
+            root[r] = last;
+            degree[i] ++; degree[last] ++;
+            length += cost(i, last);
+            added ++;
+        }
+        last = findRoot(i);
+    }
+    return length;
+}
+
+/**
+ * adds the two cheapest edges of point 0.
+ */
+double TSPLowerBound::connectSpecial(void) {
+    double c0 = 1e300, c1 = 1e300;
+    special[0] = -1; special[1] = -1;
+    for (size_t i=1; i<n; i++) {
+        double c = cost(0, i);
+        if (c < c0) {
+            c1 = c0; special[1] = special[0];
+            c0 = c; special[0] = i;
+        } else if (c < c1) {
+            c1 = c; special[1] = i;
+        }
+    }
+    degree[0] = 2;
+    degree[special[0]] ++;
+    degree[special[1]] ++;
+    return c0 + c1;
+}
+
+/**
+ * subgradient optimization of the penalties (with the step size rule of Held, Wolfe and Crowder).
+ * @param upperBound length of a known route (used for the step size)
+ * @return the best lower bound found
+ */
+double TSPLowerBound::compute(double upperBound, int maxIterations) {
+    bound = -1;
+    tour = false;
+    iterations = 0;
+    if (n < 3) return bound;
+
+    pi.assign(n, 0);
+    bestPi.assign(n, 0);
+    vector<double> lastV(n, 0);
+    double lambda = 2.0;
+    int period = 20; // iterations without improvement before lambda is halved
+    int sinceImprovement = 0;
+
+    for (iterations=0; iterations<maxIterations; iterations++) {
+        degree.assign(n, 0);
+        double length = 0;
+        if (dense) {
+            length = denseTree();
+            for (size_t i=2; i<n; i++) { degree[i] ++; degree[parent[i]] ++; }
+        } else {
+            length = sparseTree();
+        }
+        length += connectSpecial();
+
+        double sumPi = 0;
+        for (size_t i=0; i<n; i++) sumPi += pi[i];
+        double w = length - 2 * sumPi;
+
+        if (w > bound) {
+            bound = w;
+            bestPi = pi;
+            sinceImprovement = 0;
+        } else if (++sinceImprovement >= period) {
+            lambda /= 2;
+            sinceImprovement = 0;
+        }
+
+        double norm = 0;
+        for (size_t i=0; i<n; i++) norm += (degree[i] - 2) * (degree[i] - 2);
+        if (norm == 0) { tour = dense; break; } // all degrees are 2: the 1-tree is a route (optimal only on the complete graph)
+        if (lambda < 1e-6 || upperBound <= w) break;
+
+        double t = lambda * (upperBound - w) / norm;
+        for (size_t i=0; i<n; i++) {
+            // a little momentum from the last direction avoids zig-zagging:
+            double v = 0.7 * (degree[i] - 2) + 0.3 * lastV[i];
+            pi[i] += t * v;
+            lastV[i] = degree[i] - 2;
+        }
+    }
+
+    pi = bestPi;
+    return bound;
+}
+
+/**
+ * replaces the candidate lists by the k points with the lowest alpha-nearness:
+ * alpha(i,j) = how much the minimum 1-tree (with the best penalties) gets
+ * longer if it has to contain the edge (i,j). Only for the dense case, O(n^2).
+ */
+void TSPLowerBound::updateAlphaCandidates(TSPCandidateLists & c) {
+    if (!dense || bound < 0 || n < 3) return;
+    pi = bestPi;
+    denseTree();
+    connectSpecial();
+
+    // tree adjacency (points 1..n-1):
+    vector< vector<int> > adj(n);
+    for (size_t i=2; i<n; i++) { adj[i].push_back(parent[i]); adj[parent[i]].push_back(i); }
+
+    size_t k = c.getK();
+    vector<double> beta(n); // beta[j] = the longest edge on the tree path from i to j
+    vector<int> stack;
+    vector<pair<double, int> > alpha;
+    vector<int> list(k);
+    double secondOf0 = cost(0, special[1]);
+
+    for (size_t i=0; i<n; i++) {
+        alpha.clear();
+        if (i == 0) {
+            for (size_t j=1; j<n; j++) {
+                double a = ((int)j == special[0] || (int)j == special[1]) ? 0 : cost(0, j) - secondOf0;
+                alpha.push_back(make_pair(a, (int)j));
+            }
+        } else {
+            // depth first search from i:
+            inTree.assign(n, 0);
+            beta[i] = -1e300;
+            inTree[i] = 1;
+            stack.assign(1, i);
+            while (!stack.empty()) {
+                int u = stack.back(); stack.pop_back();
+                for (size_t e=0; e<adj[u].size(); e++) {
+                    int v = adj[u][e];
+                    if (inTree[v]) continue;
+                    inTree[v] = 1;
+                    double c = cost(u, v);
+                    beta[v] = (c > beta[u]) ? c : beta[u];
+                    stack.push_back(v);
+                }
+            }
+            for (size_t j=0; j<n; j++) {
+                if (j == i) continue;
+                double a;
+                if (j == 0) {
+                    a = ((int)i == special[0] || (int)i == special[1]) ? 0 : cost(0, i) - secondOf0;
+                } else {
+                    a = cost(i, j) - beta[j];
+                }
+                alpha.push_back(make_pair(a, (int)j));
+            }
+        }
+
+        size_t m = (k < alpha.size()) ? k : alpha.size();
+        partial_sort(alpha.begin(), alpha.begin() + m, alpha.end(),
+            [&](const pair<double, int> & a, const pair<double, int> & b) {
+                if (a.first != b.first) return a.first < b.first;
+                return dist->getDistance(i, a.second) < dist->getDistance(i, b.second);
+            }
+        );
+        for (size_t q=0; q<k; q++) list[q] = (q < m) ? alpha[q].second : -1;
+        c.setCandidates(i, &list[0]);
+    }
+    c.setAlpha();
+}
+
+string TSPLowerBound::debug(void) {
+    stringstream s("");
+    s << "TSPLowerBound for " << n << " points: " << bound;
+    s << " after " << iterations << " iterations";
+    if (!dense) s << " (estimate, candidate graph only)";
+    if (tour) s << " (optimal: the 1-tree is a route)";
+    s << "." << endl;
+    return s.str();
+}
+
+#endif
@@ -0,0 +1,189 @@
+#ifndef TSP_CHECKPOINT
+#define TSP_CHECKPOINT 1
+
+#include <stdint.h>
+#include <cstring> // for memcmp()
+#include <fcntl.h> // for open()
+#include <unistd.h> // for fsync(), close()
+#include <sys/mman.h> // for mmap()
+#include <sys/stat.h> // for fstat()
+
+#define CHECKPOINT_FILE "sfml-tsp.checkpoint"
+#define CHECKPOINT_INTERVAL 30 // seconds between automatic saves during long optimization runs
+#define CHECKPOINT_VERSION 2
+
+using namespace std;
+
+
+/////////////////////////////////////////////////////////////////////////////
+//                                                                         //
+// CLASSES AND METHODS:                                                    //
+//                                                                         //
+/////////////////////////////////////////////////////////////////////////////
+
+// class TSPCheckpoint declared in sfml-tsp-class-declarations.hpp
+
+/**
+ * file layout (native byte order): this header, followed by the current
+ * route and the best route, n int32 point IDs each.
+ */
+struct TSPCheckpointHeader {
+    char magic[8]; // "TSPCKPT"
+    uint32_t version;
+    uint32_t n;
+    uint64_t instanceHash; // TSPPointStore::getHash()
+    uint64_t timestamp;
+    double currentLength;
+    double bestLength;
+    int64_t successCount; // optimizer statistics
+    uint64_t randomState[4]; // state of globalRandom
+};
+
+static const char CHECKPOINT_MAGIC[8] = { 'T', 'S', 'P', 'C', 'K', 'P', 'T', 0 };
+
+TSPCheckpoint::TSPCheckpoint(string filename, int interval) {
+    this->filename = filename;
+    this->interval = interval;
+    this->lastSave = time(NULL);
+    this->best = new TSPRoute();
+    this->bestLength = -1;
+}
+
+TSPCheckpoint::~TSPCheckpoint() {
+    delete best;
+}
+
+/**
+ * remembers r if it is the best route so far.
+ */
+void TSPCheckpoint::noteRoute(TSPRoute * r) {
+    if (r == NULL) return;
+    if (bestLength < 0 || r->getLength() < bestLength) {
+        *best = *r;
+        bestLength = r->getLength();
+    }
+}
+
+/**
+ * the best route belongs to another instance now (points added or removed).
+ */
+void TSPCheckpoint::forgetBest(void) {
+    best->clear();
+    bestLength = -1;
+}
+
+static bool writeRoute(FILE * f, TSPRoute * r) {
+    for (size_t i=0; i<r->getSize(); i++) {
+        int32_t step = r->getStep(i);
+        if (fwrite(&step, sizeof(step), 1, f) != 1) return false;
+    }
+    return true;
+}
+
+/**
+ * @return whether seq holds every point ID 0..n-1 exactly once (the file may be damaged)
+ */
+static bool isValidRoute(const int32_t * seq, size_t n) {
+    static vector<char> found; // reused, no allocation per call
+    found.assign(n, 0);
+    for (size_t i=0; i<n; i++) {
+        if (seq[i] < 0 || (size_t)seq[i] >= n || found[seq[i]]) return false;
+        found[seq[i]] = 1;
+    }
+    return true;
+}
+
+/**
+ * writes the checkpoint atomically: into a temporary file first, which then replaces the old one.
+ */
+bool TSPCheckpoint::save(TSPRoute * current, TSPRouteOptimizer * opt) {
+    if (current == NULL) return false;
+    noteRoute(current);
+
+    TSPCheckpointHeader h;
+    memset(&h, 0, sizeof(h));
+    memcpy(h.magic, CHECKPOINT_MAGIC, sizeof(h.magic));
+    h.version = CHECKPOINT_VERSION;
+    h.n = current->getSize();
+    h.instanceHash = points.getHash();
+    h.timestamp = time(NULL);
+    h.currentLength = current->getLength();
+    h.bestLength = bestLength;
+    h.successCount = opt->getSuccessCount();
+    globalRandom.getState(h.randomState);
+
+    string tmpName = filename + ".tmp";
+    FILE * f = fopen(tmpName.c_str(), "wb");
+    if (f == NULL) {
+        cout << "Could not write checkpoint: " << tmpName << endl;
+        return false;
+    }
+    bool ok = (fwrite(&h, sizeof(h), 1, f) == 1) && writeRoute(f, current) && writeRoute(f, best);
+    ok = ok && (fflush(f) == 0) && (fsync(fileno(f)) == 0);
+    ok = (fclose(f) == 0) && ok;
+    if (!ok || rename(tmpName.c_str(), filename.c_str()) != 0) {
+        cout << "Could not write checkpoint: " << filename << endl;
+        remove(tmpName.c_str());
+        return false;
+    }
+
+    lastSave = time(NULL);
+    return true;
+}
+
+bool TSPCheckpoint::saveIfDue(TSPRoute * current, TSPRouteOptimizer * opt) {
+    if (time(NULL) - lastSave < interval) return false;
+    return save(current, opt);
+}
+
+/**
+ * maps the checkpoint file into memory and restores the best route, the
+ * optimizer statistics and the random state from it.
+ * @return the current route (from the route pool), or NULL if there is no
+ *         checkpoint for this instance
+ */
+TSPRoute * TSPCheckpoint::load(TSPRouteOptimizer * opt) {
+    int fd = open(filename.c_str(), O_RDONLY);
+    if (fd < 0) return NULL; // no checkpoint (yet)
+
+    struct stat st;
+    if (fstat(fd, &st) != 0 || (size_t)st.st_size < sizeof(TSPCheckpointHeader)) {
+        close(fd);
+        return NULL;
+    }
+    void * data = mmap(NULL, st.st_size, PROT_READ, MAP_PRIVATE, fd, 0);
+    close(fd);
+    if (data == MAP_FAILED) return NULL;
+
+    TSPRoute * current = NULL;
+    const TSPCheckpointHeader * h = (const TSPCheckpointHeader *)data;
+    size_t expectedSize = sizeof(TSPCheckpointHeader) + 2 * (size_t)h->n * sizeof(int32_t);
+    if (memcmp(h->magic, CHECKPOINT_MAGIC, sizeof(h->magic)) != 0 || h->version != CHECKPOINT_VERSION) {
+        cout << "Ignoring checkpoint " << filename << ": unknown format." << endl;
+    } else if (h->instanceHash != points.getHash() || h->n != points.size() || (size_t)st.st_size != expectedSize) {
+        cout << "Ignoring checkpoint " << filename << ": it belongs to a different instance." << endl;
+    } else if (!isValidRoute((const int32_t *)(h + 1), h->n) || !isValidRoute((const int32_t *)(h + 1) + h->n, h->n)) {
+        cout << "Ignoring checkpoint " << filename << ": invalid route." << endl;
+    } else {
+        const int32_t * seq = (const int32_t *)(h + 1);
+        current = routePool->acquire();
+        for (size_t i=0; i<h->n; i++) current->addStep(seq[i]);
+
+        best->clear();
+        for (size_t i=0; i<h->n; i++) best->addStep(seq[h->n + i]);
+        bestLength = best->getLength();
+
+        opt->setSuccessCount(h->successCount);
+
+        // so that the next random route is the same as without the restart:
+        globalRandom.setState(h->randomState);
+
+        cout << "Resumed from checkpoint " << filename << ": l=" << current->getLength();
+        cout << ", best l=" << bestLength << endl;
+    }
+
+    munmap(data, st.st_size);
+    return current;
+}
+
+#endif
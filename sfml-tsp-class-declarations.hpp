@@ -10,13 +10,22 @@ using namespace std;
 /////////////////////////////////////////////////////////////////////////////
 
 class TSPRoute;
+class TSPTwoLevelList;
 class TSPSplitRoute;
-class TSPPoint;
-class TSPRoutingTable;
+class TSPPointStore;
+class TSPDistanceProvider;
+class TSPOnTheFlyDistances;
+class TSPCandidateLists;
+class TSPLowerBound;
 class TSPRouteHistory;
+class TSPRoutePool;
 class TSPPainter;
 class TSPRouteOptimizer;
 class TSPRouteAnalyzer;
+class TSPCheckpoint;
+class TSPTraceLog;
+class TSPTraceReplay;
+class TSPThreadPool;
 
 
 /////////////////////////////////////////////////////////////////////////////
@@ -25,21 +34,118 @@ class TSPRouteAnalyzer;
 //                                                                         //
 /////////////////////////////////////////////////////////////////////////////
 
+/**
+ * where the optimizers and TSPRouter get their distances from:
+ * either TSPRoutingTable (full matrix) or TSPOnTheFlyDistances.
+ */
+class TSPDistanceProvider {
+    public:
+        virtual double getDistance(int i, int j) = 0;
+        /** out[k] = getDistance(i, from + k) for all points from..to-1 (overridden where a whole row is cheaper) */
+        virtual void fillDistances(int i, size_t from, size_t to, double * out) {
+            for (size_t j=from; j<to; j++) out[j - from] = getDistance(i, j);
+        }
+        virtual void updatePoint(int i) = 0; // point i is new (i == old size) or has moved
+        virtual void truncate(size_t n) = 0; // only points 0..n-1 remain
+        virtual string debug(void) = 0;
+        virtual ~TSPDistanceProvider() { }
+};
+
+/**
+ * an applied optimization step, see TSPRouteOptimizer::applyMove()
+ */
+enum TSPMoveType {
+    MOVE_NONE = 0,
+    MOVE_SWAP = 1, // switch the points at i and i+1
+    MOVE_SHIFT = 2, // move the point at i forward by j positions
+    MOVE_UNTANGLE = 3, // split after i and j, reverse the second part, join
+    MOVE_ROUTE = 4, // a completely new route (random, history, ...)
+    MOVE_TWO_OPT = 5 // reverse the points from i to j (inclusive)
+};
+
+struct TSPMove {
+    int type;
+    int i;
+    int j;
+};
+
+/**
+ * two route segments crossing each other; segment i connects the points at
+ * route positions i and i+1.
+ */
+struct TSPCrossing {
+    int i;
+    int j;
+    double x, y; // where they cross
+};
+
+/**
+ * a wall-clock deadline and / or a budget of evaluations (points looked at
+ * by the optimizer, one per candidate move, see TSPRouteOptimizer::setLimits()). expired() only reads
+ * the clock and the counters, so it is cheap enough for the operator loops
+ * and safe to call from the thread pool.
+ */
+class TSPDeadline {
+    protected:
+        bool timed;
+        chrono::steady_clock::time_point end;
+        long long budget; // < 0: unlimited
+        long long spent;
+    public:
+        TSPDeadline() { clear(); }
+        void clear(void) { timed = false; budget = -1; spent = 0; }
+        /** @param seconds from now (< 0: no deadline) @param evaluations < 0: no budget */
+        void set(double seconds, long long evaluations) {
+            clear();
+            timed = (seconds >= 0);
+            if (timed) end = chrono::steady_clock::now() + chrono::duration_cast<chrono::steady_clock::duration>(chrono::duration<double>(seconds));
+            budget = evaluations;
+        }
+        void charge(long long evaluations) { spent += evaluations; }
+        long long getSpent(void) const { return spent; }
+        bool isSet(void) const { return timed || budget >= 0; }
+        /** @param pending evaluations which have not been charged yet */
+        bool expired(long long pending = 0) const {
+            if (budget >= 0 && spent + pending >= budget) return true;
+            return timed && chrono::steady_clock::now() >= end;
+        }
+};
+
+#define HISTORY_MAX 100 // number of previous routes kept
+
 class TSPRouteHistory {
     private:
         vector<TSPRoute *> * data;
     public:
-        TSPRouteHistory(void) { data = new  vector<TSPRoute *>(100); }
-        ~TSPRouteHistory(void) { delete data; }
+        TSPRouteHistory(void) { data = new vector<TSPRoute *>(); data->reserve(HISTORY_MAX + 1); }
+        ~TSPRouteHistory(void);
         void add(TSPRoute * r);
         void back(void);
+        void clear(void);
+};
+
+/**
+ * one distinct edge of the multi-route overlay, see TSPPainter::setOverlay()
+ */
+struct TSPOverlayEdge {
+    int a, b; // point IDs, a < b
+    int count; // number of routes which contain it
 };
 
 class TSPPainter {
     protected:
 		sf::Font font0;
-        vector<sf::CircleShape> dots;
-        sf::Vertex routeLine[TSP_N+1];
+        vector<sf::CircleShape, TSPTrackedAllocator<sf::CircleShape, MEM_PAINTER> > dots;
+        vector<sf::Vertex, TSPTrackedAllocator<sf::Vertex, MEM_PAINTER> > routeLine;
+        vector<sf::Vertex, TSPTrackedAllocator<sf::Vertex, MEM_PAINTER> > crossingLines; // overlay: red crossing segments
+        vector<TSPCrossing> crossings;
+        bool showCrossings;
+        vector<TSPOverlayEdge> overlayEdges; // sorted by count, the most shared ones last
+        vector<sf::Vertex, TSPTrackedAllocator<sf::Vertex, MEM_PAINTER> > overlayLines; // all of them, one draw call
+        size_t overlayRoutes; // how many routes the overlay shows (0: none)
+        size_t overlayShared; // edges highlighted as shared
+        TSPRoute * route; // the route shown (usually currentRoute)
+        string status; // optional status line, e.g. during trace replay
         // canvas position and size:
         int canvasX0, canvasX1, canvasSX;
         int canvasY0, canvasY1, canvasSY;
@@ -47,6 +153,7 @@ class TSPPainter {
         double x0, x1, xSize;
         double y0, y1, ySize;
         bool paintPointLabels;
+        bool dirty; // true if the window content is outdated and needs a repaint
     public:
         TSPPainter(void) {
         	string font0File = FONT0;
@@ -58,14 +165,32 @@ class TSPPainter {
             canvasX0 = 0; canvasX1 = 750; canvasSX = canvasX1 - canvasX0;
             canvasY0 = 0; canvasY1 = 750; canvasSY = canvasY1 - canvasY0;
             paintPointLabels = false;
+            dirty = true;
+            route = NULL;
+            showCrossings = false;
+            overlayRoutes = 0; overlayShared = 0;
         }
         void setCanvas(int x0, int y0, int x1, int y1) {
             canvasX0 = x0; canvasX1 = x1; canvasSX = canvasX1 - canvasX0;
             canvasY0 = y0; canvasY1 = y1; canvasSY = canvasY1 - canvasY0;
+            dirty = true;
         }
-        void updatePoints(vector<TSPPoint> data);
+        // dirty tracking (see RENDER_ON_CHANGE):
+        void invalidate(void) { dirty = true; }
+        bool isDirty(void) { return dirty; }
+        void markPainted(void) { dirty = false; }
+        void setStatus(string s) { status = s; dirty = true; }
+        void updatePoints(TSPPointStore & data);
+        void addPoint(TSPPointStore & data, int i);
+        void removePoint(int i);
         void paintPoints(sf::RenderWindow * window, size_t hightlight);
         void updateRoute(TSPRoute * r);
+        void updateCrossings(void);
+        void toggleCrossings(void) { showCrossings = !showCrossings; updateCrossings(); }
+        void setOverlay(const vector<TSPRoute *> & routes);
+        void updateOverlay(void);
+        void clearOverlay(void) { overlayEdges.clear(); overlayLines.clear(); overlayRoutes = 0; overlayShared = 0; dirty = true; }
+        bool hasOverlay(void) { return overlayRoutes > 0; }
         void paintRoute(sf::RenderWindow * window);
         // convert between logical and screen coords:
         int x2px(double x);
@@ -76,9 +201,55 @@ class TSPPainter {
 
 };
 
+/**
+ * binary snapshot of the solver state, see sfml-tsp-checkpoint.hpp
+ */
+class TSPCheckpoint {
+    protected:
+        string filename;
+        int interval; // seconds between automatic saves
+        time_t lastSave;
+        TSPRoute * best; // best route seen so far (own copy)
+        double bestLength;
+    public:
+        TSPCheckpoint(string filename, int interval);
+        void noteRoute(TSPRoute * r);
+        bool save(TSPRoute * current, TSPRouteOptimizer * opt);
+        bool saveIfDue(TSPRoute * current, TSPRouteOptimizer * opt);
+        TSPRoute * load(TSPRouteOptimizer * opt);
+        TSPRoute * getBest(void) { return best; }
+        void forgetBest(void);
+        ~TSPCheckpoint();
+};
+
+/**
+ * optional recording of all applied moves into a binary file, see sfml-tsp-trace.hpp
+ */
+class TSPTraceLog {
+    protected:
+        FILE * file;
+        vector<char> buffer;
+        size_t used;
+        mutex lock;
+        chrono::steady_clock::time_point start;
+        void append(const void * data, size_t size);
+        void appendRecord(int type, int i, int j, double gain);
+    public:
+        TSPTraceLog(string filename);
+        bool isOpen(void) { return file != NULL; }
+        void recordMove(TSPMove m, double gain);
+        void recordRoute(TSPRoute * r);
+        void flush(void);
+        ~TSPTraceLog();
+        static bool toJsonLines(string traceFile, string jsonFile);
+};
+
 class TSPRouteAnalyzer {
     public:
-		static TSPSplitRoute * findIntersections(TSPRoute * r);
+		static bool findIntersections(TSPRoute * r, TSPSplitRoute * split = NULL, TSPThreadPool * pool = NULL, const TSPDeadline * deadline = NULL, long long * examined = NULL);
+		static size_t findAllCrossings(TSPRoute * r, vector<TSPCrossing> & out);
+		static size_t countCrossings(TSPRoute * r);
+		static bool segmentsCross(double ax, double ay, double bx, double by, double cx, double cy, double dx, double dy);
 };
 
 
@@ -0,0 +1,297 @@
+#ifndef TSP_DISTANCES
+#define TSP_DISTANCES 1
+
+#include <stdint.h>
+#include <algorithm> // for partial_sort()
+
+#define CANDIDATES_K 8 // number of nearest neighbours kept per point
+#define MATRIX_MAX_N 5000 // above this, distances are computed on demand instead of using TSPRoutingTable
+
+using namespace std;
+
+
+/////////////////////////////////////////////////////////////////////////////
+//                                                                         //
+// CLASSES AND METHODS:                                                    //
+//                                                                         //
+/////////////////////////////////////////////////////////////////////////////
+
+// class TSPDistanceProvider declared in sfml-tsp-class-declarations.hpp
+// class TSPRoutingTable (the full matrix, per metric) in sfml-tsp-model.hpp
+
+/**
+ * the k nearest neighbours of every point (sorted by distance), found with a
+ * uniform grid instead of comparing all pairs. Memory: O(n*k).
+ * TSPLowerBound::updateAlphaCandidates() may replace them by lists sorted by
+ * alpha; those are stale as soon as a point is added or removed, and all
+ * lists fall back to nearest neighbours then.
+ */
+class TSPCandidateLists {
+    protected:
+        size_t n;
+        size_t k;
+        vector<int, TSPTrackedAllocator<int, MEM_DISTANCES> > cand; // n*k entries; -1 if a point has less than k neighbours
+        bool alpha; // sorted by alpha instead of distance
+        void findNearest(TSPDistanceProvider & dist, size_t i);
+    public:
+        TSPCandidateLists(TSPPointStore & points, size_t k);
+        size_t getK(void) { return k; }
+        size_t getSize(void) { return n; }
+        const int * getCandidates(int i) { return &cand[(size_t)i * k]; }
+        void setCandidates(int i, const int * list) { copy(list, list + k, cand.begin() + (size_t)i * k); }
+        void setAlpha(void) { alpha = true; } // after setCandidates() for all points
+        bool isAlpha(void) { return alpha; }
+        void addPoint(TSPDistanceProvider & dist);
+        void removePoint(TSPDistanceProvider & dist, int p);
+        string debug(void);
+};
+
+TSPCandidateLists::TSPCandidateLists(TSPPointStore & points, size_t k) {
+    this->n = points.size();
+    this->k = k;
+    this->alpha = false;
+    cand.assign(n * k, -1);
+    if (n < 2 || k == 0) return;
+
+    // bounding box:
+    double minX = points.getX(0), maxX = minX;
+    double minY = points.getY(0), maxY = minY;
+    for (size_t i=1; i<n; i++) {
+        if (points.getX(i) < minX) minX = points.getX(i);
+        if (points.getX(i) > maxX) maxX = points.getX(i);
+        if (points.getY(i) < minY) minY = points.getY(i);
+        if (points.getY(i) > maxY) maxY = points.getY(i);
+    }
+
+    // about 2 points per cell:
+    int g = (int)ceil(sqrt(n / 2.0));
+    if (g < 1) g = 1;
+    double cellW = (maxX - minX) / g; if (cellW <= 0) cellW = 1;
+    double cellH = (maxY - minY) / g; if (cellH <= 0) cellH = 1;
+    double cellMin = (cellW < cellH) ? cellW : cellH;
+
+    // sort the points into their cells (counting sort):
+    vector<int> cellOf(n);
+    vector<int> cellStart(g*g + 1, 0);
+    for (size_t i=0; i<n; i++) {
+        int cx = (int)((points.getX(i) - minX) / cellW); if (cx >= g) cx = g-1;
+        int cy = (int)((points.getY(i) - minY) / cellH); if (cy >= g) cy = g-1;
+        cellOf[i] = cy * g + cx;
+        cellStart[cellOf[i] + 1] ++;
+    }
+    for (int c=0; c<g*g; c++) cellStart[c+1] += cellStart[c];
+    vector<int> cellItems(n);
+    vector<int> fill(cellStart.begin(), cellStart.end() - 1);
+    for (size_t i=0; i<n; i++) cellItems[fill[cellOf[i]]++] = i;
+
+    size_t kEff = (k < n-1) ? k : n-1;
+    vector<double> bestD2(kEff);
+    vector<int> bestIdx(kEff);
+
+    for (size_t i=0; i<n; i++) {
+        int cx = cellOf[i] % g;
+        int cy = cellOf[i] / g;
+        size_t found = 0;
+
+        // search rings of cells around the point's own cell:
+        for (int r=0; r<g; r++) {
+            for (int y=cy-r; y<=cy+r; y++) {
+                if (y < 0 || y >= g) continue;
+                for (int x=cx-r; x<=cx+r; x++) {
+                    if (x < 0 || x >= g) continue;
+                    if (y != cy-r && y != cy+r && x != cx-r && x != cx+r) continue; // only the ring itself
+
+                    int c = y*g + x;
+                    for (int m=cellStart[c]; m<cellStart[c+1]; m++) {
+                        int j = cellItems[m];
+                        if ((size_t)j == i) continue;
+                        double dx = points.getX(i) - points.getX(j);
+                        double dy = points.getY(i) - points.getY(j);
+                        double d2 = dx*dx + dy*dy;
+                        if (found == kEff && d2 >= bestD2[kEff-1]) continue;
+
+                        // insert into the sorted list of the best ones so far:
+                        size_t pos = (found < kEff) ? found++ : kEff-1;
+                        while (pos > 0 && bestD2[pos-1] > d2) {
+                            bestD2[pos] = bestD2[pos-1];
+                            bestIdx[pos] = bestIdx[pos-1];
+                            pos--;
+                        }
+                        bestD2[pos] = d2;
+                        bestIdx[pos] = j;
+                    }
+                }
+            }
+            // all cells of the next ring are at least r*cellMin away:
+            if (found == kEff && bestD2[kEff-1] <= (r*cellMin) * (r*cellMin)) break;
+        }
+
+        for (size_t m=0; m<found; m++) cand[i*k + m] = bestIdx[m];
+    }
+}
+
+/**
+ * the list of point i by comparing all pairs (in the metric of dist), for
+ * incremental updates.
+ */
+void TSPCandidateLists::findNearest(TSPDistanceProvider & dist, size_t i) {
+    static thread_local vector<double> row;
+    static thread_local vector<int> order;
+    row.resize(n);
+    dist.fillDistances(i, 0, n, row.data());
+    order.clear();
+    for (size_t j=0; j<n; j++) if (j != i) order.push_back(j);
+    size_t kEff = (k < order.size()) ? k : order.size();
+    partial_sort(order.begin(), order.begin() + kEff, order.end(), [](int a, int b) { return row[a] < row[b]; });
+    for (size_t m=0; m<k; m++) cand[i*k + m] = (m < kEff) ? order[m] : -1;
+}
+
+/**
+ * the last point of dist is new: O(n*k) instead of rebuilding all lists
+ * (alpha lists: all are rebuilt once, O(n^2), as nearest neighbours).
+ */
+void TSPCandidateLists::addPoint(TSPDistanceProvider & dist) {
+    size_t i = n++;
+    cand.resize(n * k, -1);
+    if (alpha) {
+        alpha = false;
+        for (size_t j=0; j<n; j++) findNearest(dist, j);
+        return;
+    }
+    findNearest(dist, i);
+    for (size_t j=0; j<i; j++) {
+        int * c = &cand[j*k];
+        double d = dist.getDistance(i, j);
+        // is the new point closer than the last entry (or is there a free slot)?
+        if (c[k-1] >= 0 && dist.getDistance(j, c[k-1]) <= d) continue;
+        size_t m = k-1;
+        while (m > 0 && (c[m-1] < 0 || dist.getDistance(j, c[m-1]) > d)) {
+            c[m] = c[m-1];
+            m--;
+        }
+        c[m] = i;
+    }
+}
+
+/**
+ * point p has been removed, and the last point has taken its place (dist is
+ * already updated). Only the lists which contained p are rebuilt (alpha
+ * lists: all of them, as nearest neighbours).
+ */
+void TSPCandidateLists::removePoint(TSPDistanceProvider & dist, int p) {
+    int last = n - 1;
+    if (p != last) copy(cand.begin() + (size_t)last * k, cand.begin() + (size_t)n * k, cand.begin() + (size_t)p * k);
+    n--;
+    cand.resize(n * k);
+    if (alpha) {
+        alpha = false;
+        for (size_t i=0; i<n; i++) findNearest(dist, i);
+        return;
+    }
+
+    static thread_local vector<int> outdated;
+    outdated.clear();
+    for (size_t i=0; i<n; i++) {
+        int * c = &cand[i*k];
+        bool lost = false;
+        for (size_t m=0; m<k; m++) {
+            if (c[m] == p) lost = true;
+            else if (c[m] == last) c[m] = p;
+        }
+        if (lost) outdated.push_back(i);
+    }
+    for (size_t m=0; m<outdated.size(); m++) findNearest(dist, outdated[m]);
+}
+
+string TSPCandidateLists::debug(void) {
+    stringstream s("");
+    s << "TSPCandidateLists for " << n << " points, k=" << k << (alpha ? " (alpha)" : "") << "." << endl;
+    return s.str();
+}
+
+
+/**
+ * distances computed from the coordinates on demand, so memory stays O(n*k)
+ * instead of O(n^2). Optionally, a small direct-mapped cache keeps recently
+ * used ("hot") edges, e.g. the candidate list edges.
+ */
+class TSPOnTheFlyDistances : public TSPDistanceProvider {
+    protected:
+        TSPPointStore * points;
+        vector<uint64_t, TSPTrackedAllocator<uint64_t, MEM_DISTANCES> > cacheKeys; // (min << 32 | max), or ~0 for an empty slot
+        vector<double, TSPTrackedAllocator<double, MEM_DISTANCES> > cacheValues;
+        size_t cacheMask;
+        size_t hits, misses;
+        static uint64_t key(int i, int j) { return ((uint64_t)i << 32) | (uint32_t)j; }
+    public:
+        /**
+         * @param cacheSlots size of the edge cache (rounded up to a power of 2), 0 = no cache
+         */
+        TSPOnTheFlyDistances(TSPPointStore & points, size_t cacheSlots = 0) {
+            this->points = &points;
+            hits = 0; misses = 0;
+            cacheMask = 0;
+            if (cacheSlots > 0) {
+                size_t size = 1;
+                while (size < cacheSlots) size <<= 1;
+                cacheKeys.assign(size, ~(uint64_t)0);
+                cacheValues.assign(size, 0);
+                cacheMask = size - 1;
+            }
+        }
+        double getDistance(int i, int j) {
+            if (i == j) return 0;
+            if (cacheKeys.empty()) return points->getDistance(i, j);
+
+            if (i > j) { int temp = i; i = j; j = temp; }
+            uint64_t k = key(i, j);
+            size_t slot = (size_t)((k * 0x9E3779B97F4A7C15ULL) >> 20) & cacheMask;
+            if (cacheKeys[slot] == k) { hits++; return cacheValues[slot]; }
+
+            misses++;
+            double d = points->getDistance(i, j);
+            cacheKeys[slot] = k;
+            cacheValues[slot] = d;
+            return d;
+        }
+        void fillDistances(int i, size_t from, size_t to, double * out) {
+            points->fillDistances(i, from, to, out); // SIMD, without the cache
+        }
+        void updatePoint(int i) {
+            // forget the cached edges of i:
+            for (size_t s=0; s<cacheKeys.size(); s++) {
+                uint64_t k = cacheKeys[s];
+                if (k != ~(uint64_t)0 && ((int)(k >> 32) == i || (int)(uint32_t)k == i)) cacheKeys[s] = ~(uint64_t)0;
+            }
+        }
+        void truncate(size_t n) {
+            for (size_t s=0; s<cacheKeys.size(); s++) {
+                if (cacheKeys[s] != ~(uint64_t)0 && (uint32_t)cacheKeys[s] >= n) cacheKeys[s] = ~(uint64_t)0; // the larger ID is >= n
+            }
+        }
+        /**
+         * fills the cache with all candidate list edges.
+         */
+        void prewarm(TSPCandidateLists & candidates) {
+            if (cacheKeys.empty()) return;
+            for (size_t i=0; i<candidates.getSize(); i++) {
+                const int * c = candidates.getCandidates(i);
+                for (size_t m=0; m<candidates.getK(); m++) {
+                    if (c[m] >= 0) getDistance(i, c[m]);
+                }
+            }
+            hits = 0; misses = 0;
+        }
+        string debug(void) {
+            stringstream s("");
+            s << "TSPOnTheFlyDistances for " << points->size() << " points";
+            if (!cacheKeys.empty()) {
+                s << ", edge cache with " << cacheKeys.size() << " slots (";
+                s << hits << " hits, " << misses << " misses)";
+            }
+            s << "." << endl;
+            return s.str();
+        }
+};
+
+#endif
@@ -0,0 +1,390 @@
+#ifndef TSP_EXACT
+#define TSP_EXACT 1
+
+#include <thread>
+#include <atomic>
+#include <new> // for std::bad_alloc
+
+#define EXACT_DP_MAX_N 23 // the DP table needs 2^(n-1) * (n-1) floats and as many predecessor bytes, i.e. 461 MB for 23 points (965 MB for 24)
+#define EXACT_BB_MAX_NODES 10000000 // branch and bound gives up (without proof) after this many nodes
+
+using namespace std;
+
+
+/////////////////////////////////////////////////////////////////////////////
+//                                                                         //
+// CLASSES AND METHODS:                                                    //
+//                                                                         //
+/////////////////////////////////////////////////////////////////////////////
+
+/**
+ * optimal routes for small instances (or for a subset of the points, e.g. one
+ * part of a large instance):
+ * - up to EXACT_DP_MAX_N points the Held-Karp dynamic program, O(n^2 * 2^n),
+ * - above, branch and bound with 1-tree bounds (slower, but less memory).
+ * Both use all CPU cores.
+ */
+class TSPExactSolver {
+    protected:
+        vector<int> ids; // local index -> point ID
+        size_t n;
+        vector<double> d; // n*n distances between the local points
+        TSPMetric metric;
+        TSPPointStore local; // coordinates of the local points (for TSPLowerBound)
+        unsigned int threadCount;
+        bool optimal;
+        long long nodeLimit; // branch and bound gives up after this many nodes
+        string message;
+
+        // branch and bound:
+        vector<double> pi; // Held-Karp penalties, c(i,j) = d(i,j) + pi[i] + pi[j]
+        vector<double> c;
+        atomic<long long> nodeCount;
+        atomic<bool> aborted;
+        atomic<double> bestCost;
+        mutex bestLock;
+        vector<int> bestPath;
+
+        double dist(int i, int j) { return d[(size_t)i * n + j]; }
+        typedef vector<float, TSPTrackedAllocator<float, MEM_SOLVERS> > DPTable; // the Held-Karp table can be large
+        typedef vector<uint8_t, TSPTrackedAllocator<uint8_t, MEM_SOLVERS> > DPPredecessors; // the second to last point of every entry
+        void dpLayer(DPTable & dp, DPPredecessors & pred, size_t m, int layer, size_t from, size_t to, const vector<float> & df);
+        struct Scratch {
+            vector<double> key;
+            vector<char> done;
+            vector< vector< pair<double, int> > > next; // the branches, per depth (path length)
+            void init(size_t n) { key.resize(n); next.resize(n); }
+        };
+        double bound(const vector<int> & path, const vector<char> & visited, double cost, Scratch & s);
+        void branch(vector<int> & path, vector<char> & visited, double cost, Scratch & s);
+        TSPRoute * makeRoute(const vector<int> & localPath);
+    public:
+        TSPExactSolver(TSPPointStore & points, const vector<int> & ids = vector<int>(), TSPMetric metric = METRIC_EUCLIDEAN);
+        TSPRoute * solve(TSPRoute * start = NULL);
+        TSPRoute * solveDP(void);
+        TSPRoute * solveBranchAndBound(TSPRoute * start, long long maxNodes = EXACT_BB_MAX_NODES);
+        bool isOptimal(void) { return optimal; }
+        string getMessage(void) { return message; }
+};
+
+/**
+ * @param ids the points to visit (default: all)
+ * @param metric what "optimal" refers to (the routes' getLength() is always Euclidean)
+ */
+TSPExactSolver::TSPExactSolver(TSPPointStore & points, const vector<int> & ids, TSPMetric metric) : nodeCount(0), aborted(false), bestCost(0) {
+    this->ids = ids;
+    if (ids.empty()) {
+        for (size_t i=0; i<points.size(); i++) this->ids.push_back(i);
+    }
+    this->n = this->ids.size();
+    local.resize(n);
+    for (size_t i=0; i<n; i++) local.set(i, points.getX(this->ids[i]), points.getY(this->ids[i]));
+    d.resize(n * n);
+    this->metric = metric;
+    if (metric == METRIC_EUCLIDEAN) {
+        for (size_t i=0; i<n; i++) local.fillDistances(i, 0, n, &d[i * n]);
+    } else {
+        TSPDistanceProvider * table = createRoutingTable(local, metric);
+        for (size_t i=0; i<n; i++) table->fillDistances(i, 0, n, &d[i * n]);
+        delete table;
+    }
+
+    threadCount = thread::hardware_concurrency();
+    if (threadCount < 1) threadCount = 1;
+    optimal = false;
+    nodeLimit = 0;
+}
+
+TSPRoute * TSPExactSolver::makeRoute(const vector<int> & localPath) {
+    TSPRoute * r = routePool->acquire();
+    for (size_t i=0; i<localPath.size(); i++) r->addStep(ids[localPath[i]]);
+    return r;
+}
+
+/**
+ * @param start a known route (optional), the starting upper bound for branch and bound
+ * @return the optimal route (from the route pool), or NULL
+ */
+TSPRoute * TSPExactSolver::solve(TSPRoute * start) {
+    if (n <= EXACT_DP_MAX_N) return solveDP();
+    return solveBranchAndBound(start);
+}
+
+
+/**
+ * computes all subsets with layer (= number of points) bits, for the masks from..to-1.
+ * Each of them only depends on the previous layer, so the threads never wait for each other.
+ */
+void TSPExactSolver::dpLayer(DPTable & dp, DPPredecessors & pred, size_t m, int layer, size_t from, size_t to, const vector<float> & df) {
+    for (size_t mask=from; mask<to; mask++) {
+        if (__builtin_popcountll(mask) != layer) continue;
+        float * row = &dp[mask * m];
+        for (size_t j=0; j<m; j++) {
+            if (!(mask & ((size_t)1 << j))) continue;
+            size_t prev = mask ^ ((size_t)1 << j);
+            const float * prevRow = &dp[prev * m];
+            const float * dj = &df[(j+1) * n + 1]; // distances from local point j+1
+            float best = 1e30f;
+            size_t bestI = 0;
+            for (size_t i=0; i<m; i++) {
+                if (!(prev & ((size_t)1 << i))) continue;
+                float v = prevRow[i] + dj[i];
+                if (v < best) { best = v; bestI = i; }
+            }
+            row[j] = best;
+            pred[mask * m + j] = bestI;
+        }
+    }
+}
+
+/**
+ * Held-Karp: dp[S][j] = shortest path from point 0 through all of S, ending in j.
+ * Point 0 is fixed as start, so the table has 2^(n-1) rows with n-1 entries each
+ * (float, to halve the memory), plus the predecessor of j for walking back.
+ * The rows are filled layer by layer (by the size of S), every layer split
+ * between the threads.
+ */
+TSPRoute * TSPExactSolver::solveDP(void) {
+    optimal = false;
+    if (n < 4) {
+        vector<int> path;
+        for (size_t i=0; i<n; i++) path.push_back(i);
+        optimal = true;
+        message = "trivial";
+        return makeRoute(path);
+    }
+    if (n > EXACT_DP_MAX_N) {
+        message = "too many points for the dynamic program";
+        return NULL;
+    }
+
+    size_t m = n - 1;
+    size_t rows = (size_t)1 << m;
+    vector<float> df(d.begin(), d.end());
+    DPTable dp;
+    DPPredecessors pred;
+    try {
+        dp.assign(rows * m, 1e30f);
+        pred.resize(rows * m);
+    } catch (bad_alloc & e) {
+        message = "not enough memory for the dynamic program";
+        return NULL;
+    }
+
+    for (size_t j=0; j<m; j++) dp[((size_t)1 << j) * m + j] = df[j+1];
+
+    for (size_t layer=2; layer<=m; layer++) {
+        vector<thread> workers;
+        size_t chunk = (rows + threadCount - 1) / threadCount;
+        for (unsigned int t=0; t<threadCount; t++) {
+            size_t from = t * chunk;
+            size_t to = (from + chunk < rows) ? from + chunk : rows;
+            if (from >= to) break;
+            workers.push_back(thread(&TSPExactSolver::dpLayer, this, ref(dp), ref(pred), m, (int)layer, from, to, cref(df)));
+        }
+        for (size_t t=0; t<workers.size(); t++) workers[t].join();
+    }
+
+    // close the circle, then walk back through the table:
+    size_t mask = rows - 1;
+    float best = 1e30f;
+    int last = -1;
+    for (size_t j=0; j<m; j++) {
+        float v = dp[mask * m + j] + df[j+1];
+        if (v < best) { best = v; last = j; }
+    }
+    vector<int> path(n);
+    path[0] = 0;
+    for (size_t k=m; k>=1; k--) {
+        path[k] = last + 1;
+        size_t prev = mask ^ ((size_t)1 << last);
+        if (prev == 0) break;
+        last = pred[mask * m + last];
+        mask = prev;
+    }
+
+    optimal = true;
+    stringstream ss;
+    ss << "Optimal route for " << n << " points (dynamic program, " << threadCount << " threads).";
+    message = ss.str();
+    return makeRoute(path);
+}
+
+
+/**
+ * lower bound for all completions of a partial path (with penalties): the
+ * cost so far, plus a minimum spanning tree on the unvisited points, plus the
+ * cheapest edges connecting both ends of the path to that tree.
+ */
+double TSPExactSolver::bound(const vector<int> & path, const vector<char> & visited, double cost, Scratch & s) {
+    vector<double> & key = s.key;
+    int last = path.back();
+    double toLast = 1e300, toFirst = 1e300;
+    int first = -1;
+    for (size_t i=0; i<n; i++) {
+        if (visited[i]) continue;
+        key[i] = 1e300;
+        if (c[last * n + i] < toLast) toLast = c[last * n + i];
+        if (c[i] < toFirst) toFirst = c[i];
+        if (first < 0) first = i;
+    }
+    if (first < 0) return cost + c[last * n]; // complete
+
+    // Prim (O(r^2)) on the unvisited points:
+    double tree = 0;
+    key[first] = 0;
+    vector<char> & done = s.done;
+    done = visited;
+    for (;;) {
+        int best = -1;
+        for (size_t i=0; i<n; i++) {
+            if (!done[i] && (best < 0 || key[i] < key[best])) best = i;
+        }
+        if (best < 0) break;
+        done[best] = 1;
+        tree += key[best];
+        const double * cb = &c[best * n];
+        for (size_t i=0; i<n; i++) {
+            if (!done[i] && cb[i] < key[i]) key[i] = cb[i];
+        }
+    }
+    return cost + tree + toLast + toFirst;
+}
+
+void TSPExactSolver::branch(vector<int> & path, vector<char> & visited, double cost, Scratch & s) {
+    if (aborted.load(memory_order_relaxed)) return;
+    if (++nodeCount > nodeLimit) { aborted = true; return; }
+
+    if (path.size() == n) {
+        double total = cost + c[path.back() * n];
+        lock_guard<mutex> guard(bestLock);
+        if (total < bestCost) { bestCost = total; bestPath = path; }
+        return;
+    }
+    if (bound(path, visited, cost, s) >= bestCost.load(memory_order_relaxed) - 1e-9) return;
+
+    // nearest points first:
+    int last = path.back();
+    vector< pair<double, int> > & next = s.next[path.size()]; // the deeper levels have their own
+    next.clear();
+    for (size_t i=0; i<n; i++) if (!visited[i]) next.push_back(make_pair(c[last * n + i], (int)i));
+    sort(next.begin(), next.end());
+
+    for (size_t k=0; k<next.size(); k++) {
+        int i = next[k].second;
+        path.push_back(i); visited[i] = 1;
+        branch(path, visited, cost + next[k].first, s);
+        path.pop_back(); visited[i] = 0;
+    }
+}
+
+/**
+ * depth first branch and bound. The penalties of a Held-Karp bound make the
+ * 1-tree style bounds much tighter; the subproblems below the first two
+ * levels are sorted by their bound and shared between the threads.
+ * @return the best route found (from the route pool); isOptimal() tells if
+ *         the search was completed within maxNodes
+ */
+TSPRoute * TSPExactSolver::solveBranchAndBound(TSPRoute * start, long long maxNodes) {
+    optimal = false;
+    if (n < 4) return solveDP();
+
+    // starting upper bound:
+    vector<int> startPath;
+    double startLength;
+    if (start != NULL && start->getSize() == n) {
+        vector<int> localOf(*max_element(ids.begin(), ids.end()) + 1, -1);
+        for (size_t i=0; i<n; i++) localOf[ids[i]] = i;
+        for (size_t i=0; i<n; i++) startPath.push_back(localOf[start->getStep(i)]);
+        // rotate, so that the path starts at local point 0:
+        std::rotate(startPath.begin(), find(startPath.begin(), startPath.end(), 0), startPath.end());
+    } else if (n <= SMALL_MAX_N) {
+        // 2-opt + Or-opt route (local IDs):
+        startPath.resize(n);
+        solveSmall(local, NULL, n, &startPath[0], metric);
+        std::rotate(startPath.begin(), find(startPath.begin(), startPath.end(), 0), startPath.end());
+    } else {
+        // nearest neighbour route:
+        vector<char> used(n, 0);
+        startPath.push_back(0); used[0] = 1;
+        for (size_t k=1; k<n; k++) {
+            int from = startPath.back(), best = -1;
+            for (size_t i=0; i<n; i++) {
+                if (!used[i] && (best < 0 || dist(from, i) < dist(from, best))) best = i;
+            }
+            startPath.push_back(best); used[best] = 1;
+        }
+    }
+    startLength = 0;
+    for (size_t i=0; i<n; i++) startLength += dist(startPath[i], startPath[(i+1) % n]);
+
+    // penalties:
+    TSPDistanceProvider * localDistances = (metric == METRIC_EUCLIDEAN) ? new TSPOnTheFlyDistances(local) : createRoutingTable(local, metric);
+    TSPLowerBound lb(local, localDistances, NULL);
+    lb.compute(startLength);
+    pi = lb.getPenalties();
+    delete localDistances;
+    double sumPi = 0;
+    for (size_t i=0; i<n; i++) sumPi += pi[i];
+    c.resize(n * n);
+    for (size_t i=0; i<n; i++) {
+        for (size_t j=0; j<n; j++) c[i * n + j] = d[i * n + j] + pi[i] + pi[j];
+    }
+
+    bestPath = startPath;
+    bestCost = startLength + 2 * sumPi + 1e-9;
+    nodeCount = 0;
+    nodeLimit = maxNodes;
+    aborted = false;
+
+    // subproblems: all paths 0 -> a -> b, most promising first
+    Scratch scratch;
+    scratch.init(n);
+    vector< pair<double, pair<int, int> > > tasks;
+    vector<char> visited(n, 0);
+    visited[0] = 1;
+    vector<int> path(1, 0);
+    for (size_t a=1; a<n; a++) {
+        for (size_t b=1; b<n; b++) {
+            if (a == b) continue;
+            path.push_back(a); path.push_back(b); visited[a] = 1; visited[b] = 1;
+            double cost = c[a] + c[a * n + b];
+            tasks.push_back(make_pair(bound(path, visited, cost, scratch), make_pair((int)a, (int)b)));
+            path.pop_back(); path.pop_back(); visited[a] = 0; visited[b] = 0;
+        }
+    }
+    sort(tasks.begin(), tasks.end());
+
+    atomic<size_t> nextTask(0);
+    auto worker = [&]() {
+        Scratch s;
+        s.init(n);
+        vector<char> visited(n, 0);
+        vector<int> path;
+        for (;;) {
+            size_t t = nextTask++;
+            if (t >= tasks.size() || aborted) break;
+            if (tasks[t].first >= bestCost.load(memory_order_relaxed) - 1e-9) break; // sorted: all others are worse, too
+            int a = tasks[t].second.first, b = tasks[t].second.second;
+            path.assign(1, 0); path.push_back(a); path.push_back(b);
+            visited.assign(n, 0); visited[0] = 1; visited[a] = 1; visited[b] = 1;
+            branch(path, visited, c[a] + c[a * n + b], s);
+        }
+    };
+    vector<thread> workers;
+    for (unsigned int t=0; t<threadCount; t++) workers.push_back(thread(worker));
+    for (size_t t=0; t<workers.size(); t++) workers[t].join();
+
+    optimal = !aborted;
+    stringstream ss;
+    ss << (optimal ? "Optimal" : "Best") << " route for " << n << " points (branch and bound, ";
+    ss << nodeCount.load() << " nodes, " << threadCount << " threads)";
+    if (!optimal) ss << " - node limit reached, not proven optimal";
+    ss << ".";
+    message = ss.str();
+
+    if (bestPath.size() != n) return NULL;
+    return makeRoute(bestPath);
+}
+
+#endif
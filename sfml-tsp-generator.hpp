@@ -0,0 +1,185 @@
+#ifndef TSP_GENERATOR
+#define TSP_GENERATOR 1
+
+#include <stdint.h>
+
+#define GENERATOR_CHUNK 65536 // points per random stream (and per parallel task)
+#define GENERATOR_EXTENT 2.0 // points are generated in [-GENERATOR_EXTENT, +GENERATOR_EXTENT]^2
+#define GENERATOR_CLUSTER_SIZE 10 // average points per cluster, for DIST_CLUSTERED
+
+using namespace std;
+
+
+/////////////////////////////////////////////////////////////////////////////
+//                                                                         //
+// CLASSES AND METHODS:                                                    //
+//                                                                         //
+/////////////////////////////////////////////////////////////////////////////
+
+/**
+ * xoshiro256** (D. Blackman, S. Vigna): fast, small state, and the whole
+ * state can be saved and restored (see sfml-tsp-checkpoint.hpp). Different
+ * streams of the same seed are seeded independently through SplitMix64,
+ * so that every thread (or chunk of work) can have its own.
+ */
+class TSPRandom {
+    protected:
+        uint64_t s[4];
+        static uint64_t rotl(uint64_t x, int k) { return (x << k) | (x >> (64 - k)); }
+        static uint64_t splitMix(uint64_t & x) {
+            uint64_t z = (x += 0x9E3779B97F4A7C15ULL);
+            z = (z ^ (z >> 30)) * 0xBF58476D1CE4E5B9ULL;
+            z = (z ^ (z >> 27)) * 0x94D049BB133111EBULL;
+            return z ^ (z >> 31);
+        }
+    public:
+        TSPRandom(uint64_t seed = 0, uint64_t stream = 0) { setSeed(seed, stream); }
+        void setSeed(uint64_t seed, uint64_t stream = 0) {
+            uint64_t x = seed ^ (stream * 0xD1B54A32D192ED03ULL);
+            for (int i=0; i<4; i++) s[i] = splitMix(x);
+        }
+        void getState(uint64_t * out) const { for (int i=0; i<4; i++) out[i] = s[i]; }
+        void setState(const uint64_t * in) { for (int i=0; i<4; i++) s[i] = in[i]; }
+
+        uint64_t next(void) {
+            uint64_t result = rotl(s[1] * 5, 7) * 9;
+            uint64_t t = s[1] << 17;
+            s[2] ^= s[0]; s[3] ^= s[1]; s[1] ^= s[2]; s[0] ^= s[3];
+            s[2] ^= t;
+            s[3] = rotl(s[3], 45);
+            return result;
+        }
+        /** uniform in [0, 1) */
+        double nextDouble(void) { return (next() >> 11) * 0x1.0p-53; }
+        /** uniform in 0..n-1, without modulo bias (D. Lemire) */
+        uint64_t nextBelow(uint64_t n) {
+            unsigned __int128 m = (unsigned __int128)next() * n;
+            uint64_t low = (uint64_t)m;
+            if (low < n) {
+                uint64_t threshold = -n % n;
+                while (low < threshold) {
+                    m = (unsigned __int128)next() * n;
+                    low = (uint64_t)m;
+                }
+            }
+            return (uint64_t)(m >> 64);
+        }
+        /** two independent standard normal values (Marsaglia's polar method) */
+        void nextGaussians(double & a, double & b) {
+            double u, v, q;
+            do {
+                u = 2 * nextDouble() - 1;
+                v = 2 * nextDouble() - 1;
+                q = u*u + v*v;
+            } while (q >= 1 || q == 0);
+            double f = sqrt(-2 * log(q) / q);
+            a = u * f;
+            b = v * f;
+        }
+        /** Fisher-Yates */
+        void shuffle(int * seq, size_t n) {
+            for (size_t i=n; i>1; i--) {
+                size_t j = nextBelow(i);
+                int temp = seq[i-1]; seq[i-1] = seq[j]; seq[j] = temp;
+            }
+        }
+};
+
+/**
+ * point distributions for TSPInstanceGenerator
+ */
+enum TSPDistribution {
+    DIST_UNIFORM = 0, // uniform in the square (like the DIMACS challenge's E instances)
+    DIST_CLUSTERED = 1, // normal distributions around uniform centers (like the DIMACS C instances)
+    DIST_GRID = 2, // a square lattice, row by row
+    DIST_BLOB = 3 // one normal distribution around the center (sd = extent / 6)
+};
+
+/**
+ * generates reproducible instances: the points are made in chunks of
+ * GENERATOR_CHUNK, each from its own random stream, so the result only
+ * depends on the seed - not on the number of threads.
+ */
+class TSPInstanceGenerator {
+    protected:
+        uint64_t seed;
+        vector<double> centers; // x, y for DIST_CLUSTERED
+        void generateChunk(TSPPointStore & out, size_t from, size_t to, TSPDistribution d, size_t chunk);
+    public:
+        TSPInstanceGenerator(uint64_t seed) { this->seed = seed; }
+        void generate(TSPPointStore & out, size_t n, TSPDistribution d, TSPThreadPool * pool = NULL);
+        static const char * getName(TSPDistribution d);
+};
+
+/**
+ * @param pool if not NULL, the chunks are generated in parallel
+ */
+void TSPInstanceGenerator::generate(TSPPointStore & out, size_t n, TSPDistribution d, TSPThreadPool * pool) {
+    out.resize(n);
+    if (d == DIST_CLUSTERED) {
+        // the centers come from a stream of their own:
+        size_t k = n / GENERATOR_CLUSTER_SIZE + 1;
+        TSPRandom rnd(seed, (uint64_t)-1);
+        centers.resize(2 * k);
+        for (size_t c=0; c<2*k; c++) centers[c] = (2 * rnd.nextDouble() - 1) * GENERATOR_EXTENT;
+    }
+
+    size_t chunks = (n + GENERATOR_CHUNK - 1) / GENERATOR_CHUNK;
+    if (pool != NULL) {
+        pool->parallelFor(chunks, [&](size_t c) {
+            generateChunk(out, c * GENERATOR_CHUNK, min(n, (c + 1) * GENERATOR_CHUNK), d, c);
+        });
+    } else {
+        for (size_t c=0; c<chunks; c++) generateChunk(out, c * GENERATOR_CHUNK, min(n, (c + 1) * GENERATOR_CHUNK), d, c);
+    }
+}
+
+void TSPInstanceGenerator::generateChunk(TSPPointStore & out, size_t from, size_t to, TSPDistribution d, size_t chunk) {
+    TSPRandom rnd(seed, chunk);
+    const double e = GENERATOR_EXTENT;
+    switch (d) {
+        case DIST_UNIFORM:
+            for (size_t i=from; i<to; i++) {
+                double x = (2 * rnd.nextDouble() - 1) * e;
+                double y = (2 * rnd.nextDouble() - 1) * e;
+                out.set(i, x, y);
+            }
+            break;
+        case DIST_CLUSTERED: {
+            size_t k = centers.size() / 2;
+            double sd = 2 * e / sqrt((double)out.size()); // as in the DIMACS generator
+            for (size_t i=from; i<to; i++) {
+                size_t c = rnd.nextBelow(k);
+                double gx, gy;
+                rnd.nextGaussians(gx, gy);
+                out.set(i, centers[2*c] + gx * sd, centers[2*c + 1] + gy * sd);
+            }
+            break;
+        }
+        case DIST_GRID: {
+            size_t side = (size_t)ceil(sqrt((double)out.size()));
+            double step = (side > 1) ? 2 * e / (side - 1) : 0;
+            for (size_t i=from; i<to; i++) out.set(i, -e + (i % side) * step, -e + (i / side) * step);
+            break;
+        }
+        case DIST_BLOB:
+            for (size_t i=from; i<to; i++) {
+                double gx, gy;
+                rnd.nextGaussians(gx, gy);
+                out.set(i, gx * e / 6, gy * e / 6);
+            }
+            break;
+    }
+}
+
+const char * TSPInstanceGenerator::getName(TSPDistribution d) {
+    switch (d) {
+        case DIST_UNIFORM: return "uniform";
+        case DIST_CLUSTERED: return "clustered";
+        case DIST_GRID: return "grid";
+        case DIST_BLOB: return "blob";
+        default: return "?";
+    }
+}
+
+#endif
@@ -0,0 +1,94 @@
+#ifndef TSP_GEOMETRY
+#define TSP_GEOMETRY 1
+
+#include <cmath> // for fma()
+
+using namespace std;
+
+
+/////////////////////////////////////////////////////////////////////////////
+//                                                                         //
+// ROBUST PREDICATES:                                                      //
+//                                                                         //
+/////////////////////////////////////////////////////////////////////////////
+
+// error-free transformations: a+b = x+y and a*b = x+y exactly, x being the rounded result
+inline void twoSum(double a, double b, double & x, double & y) {
+    x = a + b;
+    double bv = x - a;
+    double av = x - bv;
+    y = (a - av) + (b - bv);
+}
+
+inline void twoProduct(double a, double b, double & x, double & y) {
+    x = a * b;
+    y = fma(a, b, -x);
+}
+
+/**
+ * adds b to the expansion e[0..n-1] (non-overlapping components, increasing
+ * magnitude, zeros removed), see J. R. Shewchuk: "Adaptive Precision
+ * Floating-Point Arithmetic and Fast Robust Geometric Predicates".
+ * @return the new number of components
+ */
+inline int growExpansion(double * e, int n, double b) {
+    double q = b;
+    int m = 0;
+    for (int i=0; i<n; i++) {
+        double sum, err;
+        twoSum(q, e[i], sum, err);
+        q = sum;
+        if (err != 0) e[m++] = err;
+    }
+    if (q != 0) e[m++] = q;
+    return m;
+}
+
+/**
+ * exact sign of the orientation determinant, from the six products of the
+ * original coordinates (ax*by - ax*cy - cx*by - ay*bx + ay*cx + cy*bx).
+ */
+int orient2dExact(double ax, double ay, double bx, double by, double cx, double cy) {
+    const double f[6][2] = {
+        { ax, by }, { -ax, cy }, { -cx, by }, { -ay, bx }, { ay, cx }, { cy, bx }
+    };
+    double e[12];
+    int n = 0;
+    for (int t=0; t<6; t++) {
+        double x, y;
+        twoProduct(f[t][0], f[t][1], x, y);
+        n = growExpansion(e, n, y);
+        n = growExpansion(e, n, x);
+    }
+    if (n == 0) return 0;
+    // the largest component decides:
+    return (e[n-1] > 0) ? 1 : -1;
+}
+
+/**
+ * adaptive orientation test: the plain floating point determinant, unless it
+ * is too close to 0 to trust its sign (then the exact version).
+ * @return +1 if C is left of AB (counterclockwise), -1 if right, 0 if collinear
+ */
+int orient2d(double ax, double ay, double bx, double by, double cx, double cy) {
+    double l = (ax - cx) * (by - cy);
+    double r = (ay - cy) * (bx - cx);
+    double det = l - r;
+    if (fabs(det) > ORIENT_ERRBOUND * (fabs(l) + fabs(r))) return (det > 0) ? 1 : -1;
+    return orient2dExact(ax, ay, bx, by, cx, cy);
+}
+
+/**
+ * exact test whether AB and CD properly cross each other. Segments which only
+ * touch (an end point on the other segment) or overlap collinearly do not count.
+ */
+bool segmentsCrossExact(double ax, double ay, double bx, double by, double cx, double cy, double dx, double dy) {
+    int o1 = orient2d(ax, ay, bx, by, cx, cy);
+    int o2 = orient2d(ax, ay, bx, by, dx, dy);
+    if (o1 * o2 >= 0) return false;
+    int o3 = orient2d(cx, cy, dx, dy, ax, ay);
+    int o4 = orient2d(cx, cy, dx, dy, bx, by);
+    return o3 * o4 < 0;
+}
+
+#endif
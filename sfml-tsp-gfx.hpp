@@ -2,9 +2,12 @@
 #define TSP_GFX 1
 
 #include <stdio.h>
+#include <algorithm>
 
 #define CANVAS_W 750
 #define CANVAS_H 750
+#define OVERLAY_SHARED 0.9 // edges in at least this fraction of the overlay routes are highlighted
+#define OVERLAY_MIN_ALPHA 24 // alpha of an edge in only one of many routes (255: in all of them)
 
 
 /////////////////////////////////////////////////////////////////////////////
@@ -32,17 +35,16 @@ double TSPPainter::py2y(int y) {
     return fraction * this->ySize + this->y0;
 }
 
-void TSPPainter::updatePoints(vector<TSPPoint> data) {
-    double minX = data[0].getX();
-    double maxX = data[0].getX();
-    double minY = data[0].getY();
-    double maxY = data[0].getY();
+void TSPPainter::updatePoints(TSPPointStore & data) {
+    double minX = data.getX(0);
+    double maxX = data.getX(0);
+    double minY = data.getY(0);
+    double maxY = data.getY(0);
     for (size_t i=0; i<data.size(); i++) {
-        TSPPoint * p = &data[i];
-        if (p->getX() < minX) minX = p->getX();
-        if (p->getX() > maxX) maxX = p->getX();
-        if (p->getY() < minY) minY = p->getY();
-        if (p->getY() > maxY) maxY = p->getY();
+        if (data.getX(i) < minX) minX = data.getX(i);
+        if (data.getX(i) > maxX) maxX = data.getX(i);
+        if (data.getY(i) < minY) minY = data.getY(i);
+        if (data.getY(i) > maxY) maxY = data.getY(i);
     }
     this->xSize = (maxX - minX);
     this->ySize = (maxY - minY);
@@ -60,23 +62,54 @@ void TSPPainter::updatePoints(vector<TSPPoint> data) {
     this->ySize = maxSize * 1.1;
 
     dots.clear();
-    dots.reserve(TSP_N);
+    dots.reserve(data.size());
 
-    vector<TSPPoint>::iterator i;
-    for(i=data.begin(); i!=data.end(); ++i) {
-        // cout << (*i) << endl;
+    for (size_t i=0; i<data.size(); i++) {
+        // cout << data.describe(i) << endl;
         sf::CircleShape s(5.f);
         s.setFillColor(getRandomColor());
         s.move(-5, -5); // move center to 0;0
         s.move(
-            this->x2px((*i).getX()),
-            this->y2py((*i).getY())
+            this->x2px(data.getX(i)),
+            this->y2py(data.getY(i))
         );
         dots.push_back(s);
     }
+    updateOverlay(); // scaled again
+
+    this->dirty = true;
+}
+
+/**
+ * point i is new (the last one): only adds its dot, unless it lies outside
+ * the shown area (then everything is scaled again).
+ */
+void TSPPainter::addPoint(TSPPointStore & data, int i) {
+    double x = data.getX(i), y = data.getY(i);
+    if (x < x0 || x > x0 + xSize || y < y0 || y > y0 + ySize) {
+        updatePoints(data);
+        return;
+    }
+    sf::CircleShape s(5.f);
+    s.setFillColor(getRandomColor());
+    s.move(-5, -5); // move center to 0;0
+    s.move(this->x2px(x), this->y2py(y));
+    dots.push_back(s);
+    this->dirty = true;
+}
+
+/**
+ * point i has been removed, the last point has taken its place.
+ */
+void TSPPainter::removePoint(int i) {
+    dots[i] = dots.back();
+    dots.pop_back();
+    clearOverlay(); // its point IDs are outdated
+    this->dirty = true;
 }
 
 void TSPPainter::paintPoints(sf::RenderWindow * window, size_t highlight) {
+    TSP_ZONE("paintPoints");
     for(size_t i=0; i<dots.size(); i++) {
         if (i==highlight) {
             dots[i].setRadius(20);
@@ -105,26 +138,109 @@ void TSPPainter::paintPoints(sf::RenderWindow * window, size_t highlight) {
 }
 
 void TSPPainter::updateRoute(TSPRoute * r) {
+    TSP_ZONE("updateRoute");
+    this->routeLine.resize(r->getSize() + 1);
     for (size_t i=0; i<r->getSize(); i++) {
         int idx = r->getStep(i);
-        int x = this->x2px(points[idx].getX());
-        int y = this->y2py(points[idx].getY());
+        int x = this->x2px(points.getX(idx));
+        int y = this->y2py(points.getY(idx));
         this->routeLine[i] = sf::Vertex(sf::Vector2f(x, y));
     }
     // ... back to the first point (closest path):
     int idx = r->getStep(0);
-    int x = this->x2px(points[idx].getX());
-    int y = this->y2py(points[idx].getY());
+    int x = this->x2px(points.getX(idx));
+    int y = this->y2py(points.getY(idx));
     this->routeLine[r->getSize()] = sf::Vertex(sf::Vector2f(x, y));
+
+    this->route = r;
+    this->dirty = true;
+    if (showCrossings) updateCrossings();
+}
+
+/**
+ * the crossings overlay: all crossing segments of the shown route in red.
+ */
+void TSPPainter::updateCrossings(void) {
+    crossingLines.clear();
+    crossings.clear();
+    this->dirty = true;
+    if (!showCrossings || route == NULL) return;
+
+    TSPRouteAnalyzer::findAllCrossings(route, crossings);
+    for (size_t k=0; k<crossings.size(); k++) {
+        int seg[2] = { crossings[k].i, crossings[k].j };
+        for (int s=0; s<2; s++) {
+            int a = route->getStep(seg[s]), b = route->getStep(seg[s] + 1);
+            crossingLines.push_back(sf::Vertex(sf::Vector2f(x2px(points.getX(a)), y2py(points.getY(a))), sf::Color::Red));
+            crossingLines.push_back(sf::Vertex(sf::Vector2f(x2px(points.getX(b)), y2py(points.getY(b))), sf::Color::Red));
+        }
+    }
+}
+
+/**
+ * shows many routes at once (e.g. of a multi-start run) behind the current
+ * one: every distinct edge once, the more routes share it, the more opaque;
+ * edges in almost all of them (OVERLAY_SHARED) are highlighted. The routes
+ * are not kept.
+ */
+void TSPPainter::setOverlay(const vector<TSPRoute *> & routes) {
+    TSP_ZONE("setOverlay");
+    clearOverlay();
+    if (routes.empty()) return;
+
+    // all edges as (a, b) keys, sorted, so that equal ones are next to each other:
+    vector<uint64_t> keys;
+    for (size_t k=0; k<routes.size(); k++) {
+        TSPRoute * r = routes[k];
+        for (size_t i=0; i<r->getSize(); i++) {
+            uint32_t a = r->getStep(i), b = r->getStep(i + 1);
+            if (a > b) swap(a, b);
+            keys.push_back(((uint64_t)a << 32) | b);
+        }
+    }
+    sort(keys.begin(), keys.end());
+    for (size_t i=0; i<keys.size(); ) {
+        size_t j = i;
+        while (j < keys.size() && keys[j] == keys[i]) j++;
+        TSPOverlayEdge e = { (int)(keys[i] >> 32), (int)(keys[i] & 0xFFFFFFFF), (int)(j - i) };
+        overlayEdges.push_back(e);
+        i = j;
+    }
+    stable_sort(overlayEdges.begin(), overlayEdges.end(),
+        [](const TSPOverlayEdge & x, const TSPOverlayEdge & y) { return x.count < y.count; });
+    overlayRoutes = routes.size();
+    updateOverlay();
+}
+
+/**
+ * (re)builds the overlay's vertices from its edges, e.g. after scaling.
+ */
+void TSPPainter::updateOverlay(void) {
+    overlayLines.clear();
+    overlayShared = 0;
+    if (overlayRoutes == 0) return;
+    overlayLines.reserve(overlayEdges.size() * 2);
+    for (size_t k=0; k<overlayEdges.size(); k++) {
+        const TSPOverlayEdge & e = overlayEdges[k];
+        double share = (double)e.count / overlayRoutes;
+        sf::Color c(0, 160, 255, OVERLAY_MIN_ALPHA + (255 - OVERLAY_MIN_ALPHA) * share);
+        if (share >= OVERLAY_SHARED) { c = sf::Color(255, 200, 0, 255); overlayShared ++; }
+        overlayLines.push_back(sf::Vertex(sf::Vector2f(x2px(points.getX(e.a)), y2py(points.getY(e.a))), c));
+        overlayLines.push_back(sf::Vertex(sf::Vector2f(x2px(points.getX(e.b)), y2py(points.getY(e.b))), c));
+    }
+    this->dirty = true;
 }
 
 void TSPPainter::paintRoute(sf::RenderWindow * window) {
-    window->draw(routeLine, TSP_N+1, sf::LineStrip);
+    TSP_ZONE("paintRoute");
+    if (!overlayLines.empty()) window->draw(&overlayLines[0], overlayLines.size(), sf::Lines); // below the route
+    if (!routeLine.empty()) window->draw(&routeLine[0], routeLine.size(), sf::LineStrip);
+    if (!crossingLines.empty()) window->draw(&crossingLines[0], crossingLines.size(), sf::Lines);
 
     if (this->paintPointLabels) {
-        for(size_t i=0; i<currentRoute->getSize(); i++) {
+        for(size_t i=0; route != NULL && i<route->getSize(); i++) {
         	// which original point is at this position?
-        	int pointIdx = currentRoute->getStep(i);
+        	int pointIdx = route->getStep(i);
 
 			sf::Text text;
 			text.setFont(font0);
@@ -139,13 +255,20 @@ void TSPPainter::paintRoute(sf::RenderWindow * window) {
     }
 
     // display current route length:
-    if (currentRoute != NULL) {
+    if (route != NULL) {
     	char buffer[32];
     	char* pBuffer = &buffer[0];
-    	sprintf(pBuffer, "%02.3lf", currentRoute->getLength());
+    	sprintf(pBuffer, "%02.3lf", route->getLength());
     	string s("l=");
     	s += pBuffer;
 
+    	// ... and how far it is from the lower bound:
+    	double gap = (lowerBound != NULL) ? lowerBound->getGap(route->getLength()) : -1;
+    	if (gap >= 0) {
+    		sprintf(pBuffer, " (gap %.2lf%%%s)", gap * 100, lowerBound->isExact() ? "" : "?");
+    		s += pBuffer;
+    	}
+
 		sf::Text text;
 		text.setFont(font0);
 		text.setString(s); // print the position within the route!
@@ -173,6 +296,56 @@ void TSPPainter::paintRoute(sf::RenderWindow * window) {
 		window->draw(text);
     }
 
+    // display memory use (see sfml-tsp-memory.hpp):
+    {
+    	memoryStats.sample();
+		sf::Text text;
+		text.setFont(font0);
+		text.setString(memoryStats.describe());
+		text.setCharacterSize(12); // in pixels, not points!
+		text.setFillColor(sf::Color(127,127,127));
+
+		text.move(this->canvasX1 - 320, 30);
+		window->draw(text);
+    }
+
+    // display the number of crossings:
+    if (showCrossings) {
+		sf::Text text;
+		text.setFont(font0);
+		text.setString("crossings=" + to_string(crossings.size()));
+		text.setCharacterSize(14); // in pixels, not points!
+		text.setFillColor(sf::Color::Red);
+
+		text.move(10, 30);
+		window->draw(text);
+    }
+
+    // display the size of the overlay:
+    if (overlayRoutes > 0) {
+		sf::Text text;
+		text.setFont(font0);
+		text.setString("overlay: " + to_string(overlayRoutes) + " routes, " + to_string(overlayEdges.size()) + " edges, "
+			+ to_string(overlayShared) + " shared");
+		text.setCharacterSize(14); // in pixels, not points!
+		text.setFillColor(sf::Color(255, 200, 0));
+
+		text.move(10, 50);
+		window->draw(text);
+    }
+
+    // display the status line (e.g. trace replay position):
+    if (!status.empty()) {
+		sf::Text text;
+		text.setFont(font0);
+		text.setString(status);
+		text.setCharacterSize(14); // in pixels, not points!
+		text.setFillColor(sf::Color::Yellow);
+
+		text.move(10, this->canvasY1 - 24);
+		window->draw(text);
+    }
+
 }
 
 #endif
@@ -9,12 +9,20 @@ using namespace std;
 //                                                                         //
 /////////////////////////////////////////////////////////////////////////////
 
-vector<TSPPoint> points(TSP_N);
-TSPRoutingTable * routingTable;
+TSPPointStore points;
+TSPDistanceProvider * distances; // a TSPRoutingTable or TSPOnTheFlyDistances, see init()
+TSPCandidateLists * candidates;
+TSPLowerBound * lowerBound; // Held-Karp bound for the optimality gap, see sfml-tsp-bounds.hpp
+TSPRoutePool * routePool;
+TSPThreadPool * threadPool; // worker threads for parallel solvers, see sfml-tsp-threads.hpp
 TSPRoute * currentRoute;
 TSPRouteHistory * routeHistory;
 TSPRouteOptimizer * optimizer;
 TSPPainter * painter;
+TSPCheckpoint * checkpoint;
+TSPTraceLog * trace; // NULL unless recording
+TSPTraceReplay * replay; // NULL unless replaying a trace
+TSPMemoryStats memoryStats; // for the overlay, see sfml-tsp-memory.hpp
 
 
 int currentMouseX = -1;
@@ -22,8 +30,19 @@ int currentMouseY = -1;
 
 int highlightedPoint = -1;
 
+// the application's random numbers; the state is checkpointed (see sfml-tsp-checkpoint.hpp):
+TSPRandom globalRandom;
+
+void seedRandom(unsigned int seed) {
+    globalRandom.setSeed(seed);
+}
+
+int nextRandom(void) {
+    return (int)(globalRandom.next() >> 33); // 0..2^31-1
+}
+
 const sf::Color getRandomColor(void) {
-    int rnd = rand() % 8;
+    int rnd = nextRandom() % 8;
     switch(rnd) {
         case 0: return sf::Color::Blue;
         case 1: return sf::Color::Green;
@@ -38,8 +57,7 @@ const sf::Color getRandomColor(void) {
 }
 
 double randomDouble(void) {
-    long max = RAND_MAX;
-    return (double)rand() / max;
+    return globalRandom.nextDouble();
 }
 
 #endif
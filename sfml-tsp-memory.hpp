@@ -0,0 +1,168 @@
+#ifndef TSP_MEMORY
+#define TSP_MEMORY 1
+
+#include <atomic>
+#include <chrono>
+#include <new> // for bad_alloc
+
+using namespace std;
+
+
+/////////////////////////////////////////////////////////////////////////////
+//                                                                         //
+// MEMORY ACCOUNTING:                                                      //
+//                                                                         //
+/////////////////////////////////////////////////////////////////////////////
+
+/**
+ * the subsystems whose containers allocate through TSPTrackedAllocator
+ * (or AlignedAllocator) and are counted separately
+ */
+enum TSPMemoryCategory {
+    MEM_POINTS = 0, // TSPPointStore
+    MEM_ROUTES = 1, // TSPRoute and TSPTwoLevelList (incl. the route pool and history)
+    MEM_DISTANCES = 2, // routing table, edge cache, candidate lists
+    MEM_SOLVERS = 3, // e.g. the Held-Karp table of TSPExactSolver
+    MEM_PAINTER = 4, // dots and lines
+    MEM_COUNT = 5
+};
+
+struct TSPMemoryCounter {
+    atomic<long long> live; // bytes
+    atomic<long long> peak; // bytes
+    atomic<long long> allocations;
+};
+
+TSPMemoryCounter memoryCounters[MEM_COUNT];
+
+inline void memoryAllocated(int category, size_t bytes) {
+    TSPMemoryCounter & c = memoryCounters[category];
+    long long live = (c.live += bytes);
+    long long peak = c.peak.load();
+    while (live > peak && !c.peak.compare_exchange_weak(peak, live)) { }
+    c.allocations ++;
+}
+
+inline void memoryFreed(int category, size_t bytes) {
+    memoryCounters[category].live -= bytes;
+}
+
+/**
+ * std::allocator with bookkeeping: counts live and peak bytes and the number
+ * of allocations of one TSPMemoryCategory.
+ */
+template <class T, int Category>
+class TSPTrackedAllocator {
+    public:
+        typedef T value_type;
+        template <class U> struct rebind { typedef TSPTrackedAllocator<U, Category> other; };
+
+        TSPTrackedAllocator() { }
+        template <class U> TSPTrackedAllocator(const TSPTrackedAllocator<U, Category> &) { }
+
+        T * allocate(size_t n) {
+            T * p = (T *)::operator new(n * sizeof(T));
+            memoryAllocated(Category, n * sizeof(T));
+            return p;
+        }
+        void deallocate(T * p, size_t n) {
+            memoryFreed(Category, n * sizeof(T));
+            ::operator delete(p);
+        }
+};
+
+template <class T, class U, int C>
+bool operator==(const TSPTrackedAllocator<T, C> &, const TSPTrackedAllocator<U, C> &) { return true; }
+template <class T, class U, int C>
+bool operator!=(const TSPTrackedAllocator<T, C> &, const TSPTrackedAllocator<U, C> &) { return false; }
+
+/**
+ * reports the counters; the allocation rate refers to the time since the
+ * previous call of sample().
+ */
+class TSPMemoryStats {
+    protected:
+        chrono::steady_clock::time_point lastSample;
+        long long lastAllocations;
+        double rate; // allocations per second
+    public:
+        TSPMemoryStats() { lastSample = chrono::steady_clock::now(); lastAllocations = 0; rate = 0; }
+        void sample(void);
+        double getRate(void) { return rate; }
+        static long long getLive(void);
+        static long long getPeak(void); // sum of the peaks of all categories
+        static void resetPeaks(void);
+        static const char * getName(int category);
+        static string formatBytes(long long bytes);
+        string describe(void); // one line, for the overlay
+        string debug(void); // per category
+};
+
+void TSPMemoryStats::sample(void) {
+    chrono::steady_clock::time_point now = chrono::steady_clock::now();
+    long long allocations = 0;
+    for (int c=0; c<MEM_COUNT; c++) allocations += memoryCounters[c].allocations;
+    double seconds = chrono::duration<double>(now - lastSample).count();
+    if (seconds > 0) rate = (allocations - lastAllocations) / seconds;
+    lastSample = now;
+    lastAllocations = allocations;
+}
+
+long long TSPMemoryStats::getLive(void) {
+    long long live = 0;
+    for (int c=0; c<MEM_COUNT; c++) live += memoryCounters[c].live;
+    return live;
+}
+
+long long TSPMemoryStats::getPeak(void) {
+    long long peak = 0;
+    for (int c=0; c<MEM_COUNT; c++) peak += memoryCounters[c].peak;
+    return peak;
+}
+
+/**
+ * the peaks start again from the live bytes, e.g. before measuring one solver run
+ */
+void TSPMemoryStats::resetPeaks(void) {
+    for (int c=0; c<MEM_COUNT; c++) memoryCounters[c].peak = memoryCounters[c].live.load();
+}
+
+const char * TSPMemoryStats::getName(int category) {
+    switch (category) {
+        case MEM_POINTS: return "points";
+        case MEM_ROUTES: return "routes";
+        case MEM_DISTANCES: return "distances";
+        case MEM_SOLVERS: return "solvers";
+        case MEM_PAINTER: return "painter";
+        default: return "?";
+    }
+}
+
+string TSPMemoryStats::formatBytes(long long bytes) {
+    char buf[32];
+    if (bytes < 1024) snprintf(buf, sizeof(buf), "%lldB", bytes);
+    else if (bytes < 1024 * 1024) snprintf(buf, sizeof(buf), "%.1fK", bytes / 1024.0);
+    else snprintf(buf, sizeof(buf), "%.1fM", bytes / (1024.0 * 1024.0));
+    return string(buf);
+}
+
+string TSPMemoryStats::describe(void) {
+    stringstream ss;
+    ss << "mem=" << formatBytes(getLive());
+    ss << " (r=" << formatBytes(memoryCounters[MEM_ROUTES].live) << " d=" << formatBytes(memoryCounters[MEM_DISTANCES].live) << ")";
+    ss << " " << (long long)rate << " alloc/s";
+    return ss.str();
+}
+
+string TSPMemoryStats::debug(void) {
+    sample();
+    stringstream ss;
+    ss << "Memory: " << formatBytes(getLive()) << " live, " << (long long)rate << " allocations/s" << endl;
+    for (int c=0; c<MEM_COUNT; c++) {
+        ss << "  " << getName(c) << ": " << formatBytes(memoryCounters[c].live) << " live, ";
+        ss << formatBytes(memoryCounters[c].peak) << " peak, " << memoryCounters[c].allocations << " allocations" << endl;
+    }
+    return ss.str();
+}
+
+#endif
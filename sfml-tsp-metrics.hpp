@@ -0,0 +1,169 @@
+#ifndef TSP_METRICS
+#define TSP_METRICS 1
+
+#include <stdint.h>
+#include <cmath>
+
+#define GEO_RADIUS 6378.388 // "idealized sphere" of TSPLIB (km)
+#define GEO_PI 3.141592 // sic, as in the TSPLIB specification
+
+using namespace std;
+
+
+/////////////////////////////////////////////////////////////////////////////
+//                                                                         //
+// DISTANCE METRICS:                                                       //
+//                                                                         //
+/////////////////////////////////////////////////////////////////////////////
+
+/**
+ * the metric policies below, for choosing one at runtime (see e.g. solveSmall())
+ */
+enum TSPMetric {
+    METRIC_EUCLIDEAN = 0,
+    METRIC_EUC_2D = 1,
+    METRIC_CEIL_2D = 2,
+    METRIC_MANHATTAN = 3,
+    METRIC_MAX_NORM = 4,
+    METRIC_GEO = 5
+};
+
+/**
+ * metric policies: template parameters (no virtual calls), so that the
+ * inner loops of the fixed-size solvers (TSPSmallSolver) and the matrix of
+ * TSPMetricRoutingTable are compiled for one metric each. Every policy has
+ *   Value    the type of one distance (int for the TSPLIB integer metrics,
+ *            so that route deltas are computed exactly)
+ *   Sum      the type of a route length
+ *   distance(x1, y1, x2, y2)
+ *   improves(delta)  whether a move with this change of length is worth it
+ *   ID       the matching TSPMetric
+ * The integer metrics are meant for TSPLIB coordinates (the generated
+ * instances are far too small for them, see GENERATOR_EXTENT).
+ */
+struct MetricEuclidean { // the viewer's metric: plain double, as in TSPPointStore::getDistance()
+    static const TSPMetric ID = METRIC_EUCLIDEAN;
+    typedef double Value;
+    typedef double Sum;
+    static Value distance(double x1, double y1, double x2, double y2) {
+        double dx = x1 - x2, dy = y1 - y2;
+        return sqrt(dx*dx + dy*dy);
+    }
+    static bool improves(Value delta) { return delta < -1e-10; }
+};
+
+struct MetricEuc2D { // TSPLIB EUC_2D: rounded to the nearest integer
+    static const TSPMetric ID = METRIC_EUC_2D;
+    typedef int32_t Value;
+    typedef int64_t Sum;
+    static Value distance(double x1, double y1, double x2, double y2) {
+        double dx = x1 - x2, dy = y1 - y2;
+        return (Value)(sqrt(dx*dx + dy*dy) + 0.5);
+    }
+    static bool improves(Value delta) { return delta < 0; }
+};
+
+struct MetricCeil2D { // TSPLIB CEIL_2D: rounded up
+    static const TSPMetric ID = METRIC_CEIL_2D;
+    typedef int32_t Value;
+    typedef int64_t Sum;
+    static Value distance(double x1, double y1, double x2, double y2) {
+        double dx = x1 - x2, dy = y1 - y2;
+        return (Value)ceil(sqrt(dx*dx + dy*dy));
+    }
+    static bool improves(Value delta) { return delta < 0; }
+};
+
+struct MetricManhattan { // TSPLIB MAN_2D
+    static const TSPMetric ID = METRIC_MANHATTAN;
+    typedef int32_t Value;
+    typedef int64_t Sum;
+    static Value distance(double x1, double y1, double x2, double y2) {
+        return (Value)(fabs(x1 - x2) + fabs(y1 - y2) + 0.5);
+    }
+    static bool improves(Value delta) { return delta < 0; }
+};
+
+struct MetricMaxNorm { // TSPLIB MAX_2D
+    static const TSPMetric ID = METRIC_MAX_NORM;
+    typedef int32_t Value;
+    typedef int64_t Sum;
+    static Value distance(double x1, double y1, double x2, double y2) {
+        double dx = fabs(x1 - x2), dy = fabs(y1 - y2);
+        return (Value)((dx > dy ? dx : dy) + 0.5);
+    }
+    static bool improves(Value delta) { return delta < 0; }
+};
+
+struct MetricGeo { // TSPLIB GEO: great circle distance in km, x = latitude, y = longitude in DDD.MM
+    static const TSPMetric ID = METRIC_GEO;
+    typedef int32_t Value;
+    typedef int64_t Sum;
+    static double radians(double ddmm) {
+        int deg = (int)ddmm; // truncated, like the reference implementation (which the published optima use)
+        double min = ddmm - deg;
+        return GEO_PI * (deg + 5.0 * min / 3.0) / 180.0;
+    }
+    static Value distance(double x1, double y1, double x2, double y2) {
+        double lat1 = radians(x1), lon1 = radians(y1), lat2 = radians(x2), lon2 = radians(y2);
+        double q1 = cos(lon1 - lon2), q2 = cos(lat1 - lat2), q3 = cos(lat1 + lat2);
+        double c = 0.5 * ((1.0 + q1) * q2 - (1.0 - q1) * q3);
+        if (c > 1) c = 1; // rounding, for (almost) identical points
+        return (Value)(GEO_RADIUS * acos(c) + 1.0);
+    }
+    static bool improves(Value delta) { return delta < 0; }
+};
+
+const char * getMetricName(TSPMetric m) {
+    switch (m) {
+        case METRIC_EUCLIDEAN: return "euclidean";
+        case METRIC_EUC_2D: return "EUC_2D";
+        case METRIC_CEIL_2D: return "CEIL_2D";
+        case METRIC_MANHATTAN: return "MAN_2D";
+        case METRIC_MAX_NORM: return "MAX_2D";
+        case METRIC_GEO: return "GEO";
+        default: return "?";
+    }
+}
+
+/**
+ * @param edgeWeightType as in a TSPLIB file
+ * @return the metric, METRIC_EUCLIDEAN for unknown or missing types
+ */
+TSPMetric metricFromTSPLib(const string & edgeWeightType) {
+    if (edgeWeightType == "EUC_2D") return METRIC_EUC_2D;
+    if (edgeWeightType == "CEIL_2D") return METRIC_CEIL_2D;
+    if (edgeWeightType == "MAN_2D") return METRIC_MANHATTAN;
+    if (edgeWeightType == "MAX_2D") return METRIC_MAX_NORM;
+    if (edgeWeightType == "GEO") return METRIC_GEO;
+    return METRIC_EUCLIDEAN;
+}
+
+/**
+ * the length of a route (point IDs) in the metric of the policy.
+ */
+template <class Metric>
+typename Metric::Sum metricTourLength(const TSPPointStore & points, const int * seq, size_t n) {
+    typename Metric::Sum sum = 0;
+    for (size_t i=0; i<n; i++) {
+        int a = seq[i], b = seq[(i + 1 == n) ? 0 : i + 1];
+        sum += Metric::distance(points.getX(a), points.getY(a), points.getX(b), points.getY(b));
+    }
+    return sum;
+}
+
+/**
+ * metricTourLength() for a metric chosen at runtime.
+ */
+double metricTourLength(TSPMetric m, const TSPPointStore & points, const int * seq, size_t n) {
+    switch (m) {
+        case METRIC_EUC_2D: return metricTourLength<MetricEuc2D>(points, seq, n);
+        case METRIC_CEIL_2D: return metricTourLength<MetricCeil2D>(points, seq, n);
+        case METRIC_MANHATTAN: return metricTourLength<MetricManhattan>(points, seq, n);
+        case METRIC_MAX_NORM: return metricTourLength<MetricMaxNorm>(points, seq, n);
+        case METRIC_GEO: return metricTourLength<MetricGeo>(points, seq, n);
+        default: return metricTourLength<MetricEuclidean>(points, seq, n);
+    }
+}
+
+#endif
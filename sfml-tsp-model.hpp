@@ -10,118 +10,200 @@ using namespace std;
 //                                                                         //
 /////////////////////////////////////////////////////////////////////////////
 
-class TSPPoint {
-    protected:
-        double x;
-        double y;
-        sf::Vector2<double> * v2d;
-    public:
-        TSPPoint() { x=0; y=0; this->v2d = new sf::Vector2<double>(x,y); }
-        TSPPoint(double x, double y) { this->x=x; this->y=y; this->v2d = new sf::Vector2<double>(x,y); }
-        double getX(void) { return x; }
-        double getY(void) { return y; }
-        double getDistanceTo(double x, double y) {
-            double dx = this->x - x;
-            double dy = this->y - y;
-            return sqrt(dx*dx + dy*dy);
-        }
-        double getDistanceTo(TSPPoint other) { return getDistanceTo(other.getX(), other.getY()); }
-        sf::Vector2<double> const * getVector2(void) { return v2d; }
-        // ~TSPPoint() { delete v2d; }
-
-    // allow the following function to access private elements:
-    friend ostream& operator<<(ostream& os, TSPPoint const& p);
-};
+// point coordinates: class TSPPointStore in sfml-tsp-points.hpp
 
-ostream& operator<<(ostream& os, TSPPoint const& p) {
-    os << "TSPPoint(" << p.x << ";" << p.y << ")";
-    return os;
-}
-
-class TSPRoutingTable {
+/**
+ * the full distance matrix in the metric of the policy (see sfml-tsp-metrics.hpp);
+ * integer metrics are stored as int32, i.e. in half the memory. The solvers
+ * read it through TSPDistanceProvider, i.e. as double (whole rows at once
+ * with fillDistances()).
+ */
+template <class Metric>
+class TSPMetricRoutingTable : public TSPDistanceProvider {
+    public:
+        typedef typename Metric::Value Value;
     private:
         int n;
-        double distances[TSP_N][TSP_N];
+        TSPPointStore * points;
+        vector<Value, TSPTrackedAllocator<Value, MEM_DISTANCES> > distances; // packed lower triangle: row i holds the distances to 0..i-1
+        size_t rowOffset(size_t i) { return i * (i - 1) / 2; }
+        void fillRow(int i) {
+            Value * row = &distances[rowOffset(i)];
+            double x = points->getX(i), y = points->getY(i);
+            for (int j=0; j<i; j++) row[j] = Metric::distance(x, y, points->getX(j), points->getY(j));
+        }
+        Value get(int i, int j) {
+            if (i>j) return distances[rowOffset(i) + j];
+            if (i<j) return distances[rowOffset(j) + i];
+            return 0;
+        }
     public:
-        TSPRoutingTable(vector<TSPPoint> points) {
-            if (points.size() > TSP_N) {
-                cout << "Too many points in constructor of TSPRoutingTable!" << endl;
-                exit(1);
-            }
+        TSPMetricRoutingTable(TSPPointStore & points) {
+            this->points = &points;
             n = points.size();
-            for (size_t i=0; i<points.size(); i++) {
-                for (size_t j=i+1; j<points.size(); j++) {
-                    distances[i][j] = points[i].getDistanceTo(points[j]);
-                }
+            distances.resize((size_t)n * (n-1) / 2);
+            for (int i=1; i<n; i++) fillRow(i);
+        }
+        double getDistance(int i, int j) { return get(i, j); }
+        void fillDistances(int i, size_t from, size_t to, double * out) {
+            for (size_t j=from; j<to; j++) out[j - from] = get(i, j); // no virtual call per distance
+        }
+        /**
+         * O(n): a new point only appends a row, a moved point updates its row and column.
+         */
+        void updatePoint(int i) {
+            if (i >= n) {
+                n = i + 1;
+                distances.resize((size_t)n * (n-1) / 2);
+            }
+            if (i > 0) fillRow(i);
+            for (int j=i+1; j<n; j++) {
+                distances[rowOffset(j) + i] = Metric::distance(points->getX(j), points->getY(j), points->getX(i), points->getY(i));
             }
         }
-        double getDistance(int i, int j) {
-            if (i<j) return distances[i][j];
-            if (i==j) return 0;
-            if (i>j) return distances[j][i];
-            return 0;
+        void truncate(size_t n) {
+            this->n = n;
+            distances.resize(n * (n-1) / 2);
         }
         string debug(void) {
             stringstream s("");
-            s << "TSPRoutingTable for " << n << " points, i.e. " << (n*(n-1)/2) << " relations." << endl;
+            s << "TSPRoutingTable (" << getMetricName(Metric::ID) << ") for " << n << " points, i.e. " << ((size_t)n*(n-1)/2) << " relations." << endl;
             return s.str();
         }
         int findClosestPointIdx(double x, double y) {
-            double minD = 1e100;
-            double minIdx = -1;
-
-            // iterate all points, remember the one with the least distance to x;y
-            for (size_t i=0; i<points.size(); i++) {
-                double d = points[i].getDistanceTo(x,y);
-                if (d < minD) {
-                    minD = d;
-                    minIdx = i;
-                }
-            }
-
-            return minIdx;
+            // the point with the least distance to x;y
+            return points->findClosest(x, y);
         }
 };
 
+/**
+ * the Euclidean rows come from the SIMD kernel (the same values as TSPPointStore::getDistance()).
+ */
+template <>
+void TSPMetricRoutingTable<MetricEuclidean>::fillRow(int i) {
+    points->fillDistances(i, 0, i, &distances[rowOffset(i)]);
+}
+
+typedef TSPMetricRoutingTable<MetricEuclidean> TSPRoutingTable; // the viewer's metric
+
+/**
+ * @return the full matrix for the metric chosen at runtime
+ */
+TSPDistanceProvider * createRoutingTable(TSPPointStore & points, TSPMetric metric) {
+    switch (metric) {
+        case METRIC_EUC_2D: return new TSPMetricRoutingTable<MetricEuc2D>(points);
+        case METRIC_CEIL_2D: return new TSPMetricRoutingTable<MetricCeil2D>(points);
+        case METRIC_MANHATTAN: return new TSPMetricRoutingTable<MetricManhattan>(points);
+        case METRIC_MAX_NORM: return new TSPMetricRoutingTable<MetricMaxNorm>(points);
+        case METRIC_GEO: return new TSPMetricRoutingTable<MetricGeo>(points);
+        default: return new TSPRoutingTable(points);
+    }
+}
+
 class TSPRoute {
     protected:
         double length;
-        vector<int> seq;
+        typedef vector<int, TSPTrackedAllocator<int, MEM_ROUTES> > IntVector;
+        IntVector seq;
+        IntVector pos; // inverse of seq: pos[pointID] = index of that point in seq (or -1)
+        TSPTwoLevelList * list; // replaces seq and pos for large routes (see TWO_LEVEL_MIN_N), or NULL
+        TSPTwoLevelList * parked; // the list of a cleared route, kept for its capacity, or NULL
+        TSPTwoLevelList * unpark(void) {
+            TSPTwoLevelList * l = (parked != NULL) ? parked : new TSPTwoLevelList();
+            parked = NULL;
+            return l;
+        }
+        void setPos(int point, int idx) {
+            if ((size_t)point >= pos.size()) pos.resize(point + 1, -1);
+            pos[point] = idx;
+        }
     public:
-        TSPRoute() { this->length = -1; }
+        TSPRoute() { this->length = -1; this->list = NULL; this->parked = NULL; }
+        TSPRoute(const TSPRoute & other);
+        TSPRoute & operator=(const TSPRoute & other);
+        ~TSPRoute() { delete list; delete parked; }
         TSPRoute * clone(void);
     // get / evaluate:
         bool equals(TSPRoute * other);
         int getIndexOf(int pointID);
-        int getStep(int idx) { return seq[(idx + getSize()) % getSize()]; }
-        size_t getSize(void) { return seq.size(); }
+        int getStep(int idx) {
+            size_t i = (idx + getSize()) % getSize();
+            return (list != NULL) ? list->at(i) : seq[i];
+        }
+        size_t getSize(void) { return (list != NULL) ? list->size() : seq.size(); }
         bool isComplete(void);
         bool hasDuplicatePoints(void);
         double getLength(void);
+        bool isTwoLevel(void) { return list != NULL; }
+        void setLength(double l) { length = l; } // when it is known anyway, e.g. from the gain of a move
+    // neighbours in O(1), by point ID:
+        int next(int pointID) { return getStep(getIndexOf(pointID) + 1); }
+        int prev(int pointID) { return getStep(getIndexOf(pointID) - 1); }
+        bool between(int a, int b, int c);
     // modify:
         void addStep(int idx) {
+            length = -1; // length has to be recalculated
+            if (list != NULL) { list->append(idx); return; }
+            setPos(idx, seq.size());
         	seq.push_back(idx);
-        	length = -1; // length has to be recalculated
+        	if (seq.size() >= TWO_LEVEL_MIN_N) {
+        	    // large route: switch to the two-level list
+        	    list = unpark();
+        	    list->assign(seq.data(), seq.size());
+        	    seq.clear(); seq.shrink_to_fit();
+        	    pos.clear(); pos.shrink_to_fit();
+        	}
         }
         void setStep(int idx, int point) {
-            seq[(idx + getSize()) % getSize()] = point;
+            idx = (idx + getSize()) % getSize();
             length = -1; // length has to be recalculated
+            if (list != NULL) { list->set(idx, point); return; }
+            seq[idx] = point;
+            setPos(point, idx);
         }
         void moveStepForward(int idx);
         void reverse(void);
         void reverseFromTo(int a, int b);
+        void clear(void) {
+            // keeps the allocated capacity for reuse (see TSPRoutePool):
+            seq.clear();
+            if (list != NULL) {
+                delete parked;
+                parked = list;
+                list = NULL;
+            }
+            length = -1;
+        }
     // output tools:
         string describe(void);
         string describePoints(void);
 };
 
-TSPRoute * TSPRoute::clone(void) {
-    TSPRoute * retval = new TSPRoute();
-    for (size_t i=0; i<seq.size(); i++) {
-        retval->addStep(seq[i]);
+TSPRoute::TSPRoute(const TSPRoute & other) {
+    list = NULL;
+    parked = NULL;
+    *this = other;
+}
+
+TSPRoute & TSPRoute::operator=(const TSPRoute & other) {
+    if (this == &other) return *this;
+    length = other.length;
+    seq = other.seq;
+    pos = other.pos;
+    if (other.list != NULL) {
+        // copy into our own list, reusing its segments:
+        if (list == NULL) list = unpark();
+        list->assign(*other.list);
+    } else if (list != NULL) {
+        delete parked;
+        parked = list;
+        list = NULL;
     }
+    return *this;
+}
 
-    return retval;
+TSPRoute * TSPRoute::clone(void) {
+    return new TSPRoute(*this);
 }
 
 /**
@@ -138,29 +220,32 @@ void TSPRoute::moveStepForward(int idx) {
 
 
 void TSPRoute::reverse(void) {
-	// create a new vector containing the elements in reverse order:
-	vector<int> seq1;
-	for (size_t i=seq.size(); i>0; i--) seq1.push_back(seq[i-1]);
-
-	// copy back the new vector:
-	for (size_t i=0; i<seq.size(); i++)	seq[i] = seq1[i];
+	if (this->getSize() == 0) return;
+	this->reverseFromTo(0, this->getSize() - 1);
 }
 
 
 /**
- * reverses a part of the route: points from index #a to #b (inclusive)
+ * reverses a part of the route: points from index #a to #b (inclusive, wraps around if b < a)
  */
 void TSPRoute::reverseFromTo(int a, int b) {
+	if (list != NULL) {
+		// O(sqrt(n)) instead of O(n):
+		list->reverse((a + getSize()) % getSize(), (b + getSize()) % getSize());
+		length = -1;
+		return;
+	}
+
 	if (b < a) b+= this->getSize();
-	size_t length = b - a + 1;
-	// create a new vector containing the elements in reverse order:
-	vector<int> seq1;
-	for (size_t i=0; i<length; i++) {
-		seq1.push_back(getStep(b-i));
+	// swap from both ends towards the middle:
+	for (; a < b; a++, b--) {
+		int ptA = this->getStep(a);
+		int ptB = this->getStep(b);
+		this->setStep(a, ptB);
+		this->setStep(b, ptA);
 	}
 
-	// copy back the new vector:
-	for (size_t i=0; i<length; i++) seq[a+i] = seq1[i];
+    length = -1; // length has to be recalculated
 }
 
 
@@ -168,7 +253,7 @@ bool TSPRoute::equals(TSPRoute * other) {
     if (other == NULL) return false;
 	if (this->getSize() != other->getSize()) return false;
     for (size_t i=0; i<this->getSize(); i++) {
-        if (this->seq[i] != other->seq[i]) return false;
+        if (this->getStep(i) != other->getStep(i)) return false;
     }
     // same size, all points are the same:
     return true;
@@ -176,25 +261,22 @@ bool TSPRoute::equals(TSPRoute * other) {
 
 
 bool TSPRoute::isComplete() {
-    static bool found[TSP_N];
-    for (size_t i=0; i<TSP_N; i++) found[i] = false;
-    for (size_t i=0; i<seq.size(); i++) {
-        found[seq[i]] = true;
+    static thread_local vector<char> found; // reused, no allocation per call
+    found.assign(points.size(), 0);
+    for (size_t i=0; i<this->getSize(); i++) {
+        found[this->getStep(i)] = 1;
     }
-    for (size_t i=0; i<TSP_N; i++) {
+    for (size_t i=0; i<found.size(); i++) {
         if (!found[i]) return false;
     }
     return true;
 }
 
 bool TSPRoute::hasDuplicatePoints() {
-    static int cnt[TSP_N];
-    for (size_t i=0; i<TSP_N; i++) cnt[i] = 0;
-    for (size_t i=0; i<seq.size(); i++) {
-        cnt[seq[i]] ++;
-    }
-    for (size_t i=0; i<TSP_N; i++) {
-        if (cnt[i] > 1) return true;
+    static thread_local vector<int> cnt; // reused, no allocation per call
+    cnt.assign(points.size(), 0);
+    for (size_t i=0; i<this->getSize(); i++) {
+        if (++cnt[this->getStep(i)] > 1) return true;
     }
     return false;
 }
@@ -202,28 +284,33 @@ bool TSPRoute::hasDuplicatePoints() {
 double TSPRoute::getLength() {
     if (length >= 0) return length;
 
-    // okay, we have to calculate:
-    for (size_t i=0; i<seq.size(); i++) {
-        int from = seq[i];
-        int to = -1;
-        if (i<seq.size()-1) {
-            to = seq[i+1]; // either the next point,
-        } else {
-            to = seq[0]; // or back to the first one.
-        }
-
-        length += points[from].getDistanceTo(points[to]);
+    // okay, we have to calculate (from each point to the next, and back to the first one):
+    if (list != NULL) {
+        length = list->getLength(points);
+    } else {
+        length = points.getTourLength(seq.data(), seq.size());
     }
 
     return length;
 }
 
 int TSPRoute::getIndexOf(int pointID) {
-	for (size_t i=0; i<this->getSize(); i++) {
-		if (this->getStep(i) == pointID) return i;
-	}
-	// not found!
-	return -1;
+	if (list != NULL) return list->indexOf(pointID);
+	if (pointID < 0 || (size_t)pointID >= pos.size()) return -1;
+	int idx = pos[pointID];
+	// not found (or outdated, e.g. after overwriting the point with setStep()):
+	if (idx < 0 || (size_t)idx >= seq.size() || seq[idx] != pointID) return -1;
+	return idx;
+}
+
+/**
+ * @return true if point b is passed when travelling (forward) from point a to point c
+ */
+bool TSPRoute::between(int a, int b, int c) {
+	int pa = getIndexOf(a), pb = getIndexOf(b), pc = getIndexOf(c);
+	if (pa <= pc) return (pa <= pb && pb <= pc);
+	// the way from a to c wraps around the end of the route:
+	return (pb >= pa || pb <= pc);
 }
 
 string TSPRoute::describe(void) {
@@ -259,23 +346,32 @@ string TSPRoute::describePoints(void) {
 }
 
 
+/**
+ * a route cut into two parts. Can be re-assigned, so that the same object
+ * (and its storage) is reused for many splits.
+ */
 class TSPSplitRoute {
 	private:
-		TSPRoute * ra;
-		TSPRoute * rb;
+		TSPRoute ra;
+		TSPRoute rb;
+		size_t splitA, splitB; // as given to assign(), splitA < splitB
 	public:
-		TSPSplitRoute(TSPRoute * orig, size_t splitA, size_t splitB);
+		TSPSplitRoute() { splitA = 0; splitB = 0; }
+		TSPSplitRoute(TSPRoute * orig, size_t splitA, size_t splitB) { assign(orig, splitA, splitB); }
+		void assign(TSPRoute * orig, size_t splitA, size_t splitB);
+		size_t getSplitA(void) { return splitA; }
+		size_t getSplitB(void) { return splitB; }
 		string describe(void);
 		void reverseB(void);
 		TSPRoute * join(void);
-		~TSPSplitRoute() { delete ra; delete rb; }
+		void joinInto(TSPRoute * target);
 };
 
 /**
  * @param splitA the index of the point in the route AFTER which the first cut should be made
  * @param splitB the index of the point in the route AFTER which the second cut should be made
  */
-TSPSplitRoute::TSPSplitRoute(TSPRoute * orig, size_t splitA, size_t splitB) {
+void TSPSplitRoute::assign(TSPRoute * orig, size_t splitA, size_t splitB) {
 	if (orig == NULL) { throw new runtime_error("TSPSplitRoute: original route is NULL!"); exit(1); }
 	if (splitA == splitB) { throw new runtime_error("TSPSplitRoute: split points A and B are identical!"); exit(1); }
 
@@ -286,74 +382,117 @@ TSPSplitRoute::TSPSplitRoute(TSPRoute * orig, size_t splitA, size_t splitB) {
 		splitB = temp;
 	}
 
-	this->ra = new TSPRoute();
+	this->splitA = splitA;
+	this->splitB = splitB;
+
+	ra.clear();
 	for (size_t i=splitA + 1 ; i <= splitB; i++) {
-		ra->addStep(orig->getStep(i));
+		ra.addStep(orig->getStep(i));
 	}
 
 	// wrap over the end of the route:
 	splitA += orig->getSize();
 
-	this->rb = new TSPRoute();
+	rb.clear();
 	for (size_t i=splitB + 1 ; i <= splitA; i++) {
-		rb->addStep(orig->getStep(i));
+		rb.addStep(orig->getStep(i));
 	}
 
-	if (ra->getSize() + rb->getSize() != orig->getSize()) {
+	if (ra.getSize() + rb.getSize() != orig->getSize()) {
 		throw new runtime_error("TSPSplitRoute: something went wrong (unexpected size of split routes...)!"); exit(1);
 	}
 }
 
 void TSPSplitRoute::reverseB(void) {
-	rb->reverse();
+	rb.reverse();
 }
 
 TSPRoute * TSPSplitRoute::join(void) {
 	TSPRoute * retval = new TSPRoute();
-	for (size_t i=0; i<ra->getSize(); i++) retval->addStep(ra->getStep(i));
-	for (size_t i=0; i<rb->getSize(); i++) retval->addStep(rb->getStep(i));
+	joinInto(retval);
 	return retval;
 }
 
+/**
+ * writes part A followed by part B into target (which is cleared first).
+ */
+void TSPSplitRoute::joinInto(TSPRoute * target) {
+	target->clear();
+	for (size_t i=0; i<ra.getSize(); i++) target->addStep(ra.getStep(i));
+	for (size_t i=0; i<rb.getSize(); i++) target->addStep(rb.getStep(i));
+}
+
 string TSPSplitRoute::describe(void) {
 	stringstream ss;
 	ss << "Split route:" << endl;
-	ss << "Part A: " << ra->describe();
-	ss << "Part B: " << rb->describe();
+	ss << "Part A: " << ra.describe();
+	ss << "Part B: " << rb.describe();
 	return ss.str();
 }
 
 
+/**
+ * recycles TSPRoute objects (and their storage), so that the optimizers do
+ * not allocate new routes in steady state. Routes which are no longer used
+ * (e.g. dropped from the history) have to be given back with release().
+ * A released route keeps its two-level list (if any), so copies of large
+ * routes reuse the segments instead of allocating about sqrt(n) of them.
+ */
+class TSPRoutePool {
+	protected:
+		vector<TSPRoute *> available;
+		size_t created;
+	public:
+		TSPRoutePool() { created = 0; }
+		TSPRoute * acquire(void) {
+			if (available.empty()) {
+				created ++;
+				return new TSPRoute();
+			}
+			TSPRoute * r = available.back();
+			available.pop_back();
+			return r;
+		}
+		TSPRoute * acquireCopy(TSPRoute * original) {
+			TSPRoute * r = acquire();
+			*r = *original; // reuses the capacity of r
+			return r;
+		}
+		void release(TSPRoute * r) {
+			if (r == NULL) return;
+			r->clear();
+			available.push_back(r);
+		}
+		size_t getCreatedCount(void) { return created; }
+		size_t getAvailableCount(void) { return available.size(); }
+		~TSPRoutePool() {
+			for (size_t i=0; i<available.size(); i++) delete available[i];
+		}
+};
+
+
 class TSPRouter {
     public:
         static TSPRoute * naiveOrdered(void) {
-            TSPRoute * r = new TSPRoute();
-            for (size_t i=0; i<TSP_N; i++) r->addStep(i);
+            TSPRoute * r = routePool->acquire();
+            for (size_t i=0; i<points.size(); i++) r->addStep(i);
             return r;
         }
         static TSPRoute * naiveRandom(void) {
-            int seq[TSP_N]; for (int i=0; i<TSP_N; i++) seq[i] = i;
+            static thread_local vector<int> seq; // reused, no allocation per call
+            seq.resize(points.size());
+            for (size_t i=0; i<seq.size(); i++) seq[i] = i;
+            globalRandom.shuffle(seq.data(), seq.size());
 
-            // shuffle the sequence 100 times completely:
-            for (int rounds = 0; rounds<100; rounds++) {
-                for (size_t i=0; i<TSP_N; i++) {
-                    int j=rand() % TSP_N;
-
-                    int temp = seq[i];
-                    seq[i] = seq[j];
-                    seq[j] = temp;
-                }
-            }
-
-            TSPRoute * r = new TSPRoute();
-            for (size_t i=0; i<TSP_N; i++) r->addStep(seq[i]);
+            TSPRoute * r = routePool->acquire();
+            for (size_t i=0; i<seq.size(); i++) r->addStep(seq[i]);
             return r;
         }
         static TSPRoute * naiveClosest(void) {
-            bool free[TSP_N];
-            for (size_t i=0; i<TSP_N; i++) free[i] = true;
+            size_t n = points.size();
+            vector<char> free(n, true);
 
-            TSPRoute * r = new TSPRoute();
+            TSPRoute * r = routePool->acquire();
 
             // add the origin:
             size_t currentIdx = 0;
@@ -361,14 +500,14 @@ class TSPRouter {
             free[currentIdx] = false;
 
             // find TSP-N - 1 connections:
-            for (size_t i=1; i<TSP_N; i++) {
+            for (size_t i=1; i<n; i++) {
                 // cout << "Searching for the best destination from pt #" << currentIdx << ": " << endl;
                 int closestIdx = -1;
                 double closestDistance = 1e100;
-                for (size_t j=0; j<TSP_N; j++) {
+                for (size_t j=0; j<n; j++) {
                     if (j==currentIdx) continue;
                     if (!free[j]) continue;
-                    double d = routingTable->getDistance(currentIdx, j);
+                    double d = distances->getDistance(currentIdx, j);
                     if (d < closestDistance) {
                         // cout << "    " << j << " is closer to " << currentIdx << ": " << d << endl;
                         closestIdx = j;
@@ -387,151 +526,558 @@ class TSPRouter {
         }
 };
 
+#define UNTANGLE_MAX_PASSES 100 // for TSPRouteOptimizer::untangleAll()
+#define REPAIR_MAX_MOVES 1000 // for TSPRouteOptimizer::twoOptAround()
+#define SCHEDULER_EXPLORATION 0.5 // weight of the UCB exploration term, see TSPOperatorScheduler::pick()
+
+/**
+ * the local search operators which TSPRouteOptimizer::optimizeStep() chooses from
+ */
+enum TSPOperator {
+    OP_SWAP = 0, // switchAnyTwoPoints()
+    OP_UNTANGLE = 1, // untangleIntersection()
+    OP_SHIFT = 2, // moveSinglePoint()
+    OP_COUNT = 3
+};
+
+/**
+ * picks the next operator for optimizeStep(): a multi-armed bandit (UCB1) on
+ * the gain per (wall-clock) second of every operator. It also keeps, per operator, a
+ * queue of "dirty" points (touched by recent moves): only these are looked at,
+ * until the queue is empty; then one full scan decides whether the operator
+ * is exhausted (no improvement possible until the route changes).
+ */
+class TSPOperatorScheduler {
+    protected:
+        struct Stats {
+            int calls;
+            int successes;
+            double gain;
+            double seconds;
+        } stats[OP_COUNT];
+        bool exhausted[OP_COUNT];
+        deque<int> dirty[OP_COUNT];
+        vector<char> queued[OP_COUNT];
+        int totalCalls;
+    public:
+        TSPOperatorScheduler() { clearStats(); reset(0); }
+        void clearStats(void);
+        void reset(size_t n);
+        void markDirty(int pointID);
+        int pick(void);
+        int nextDirty(int op);
+        bool hasDirty(int op) { return !dirty[op].empty(); }
+        void setExhausted(int op) { exhausted[op] = true; }
+        void setLocalOptimum(size_t n) { reset(n); for (int op=0; op<OP_COUNT; op++) exhausted[op] = true; }
+        void record(int op, double gain, double seconds);
+        static const char * getName(int op);
+        string debug(void);
+};
+
+void TSPOperatorScheduler::clearStats(void) {
+    totalCalls = 0;
+    for (int op=0; op<OP_COUNT; op++) stats[op] = Stats { 0, 0, 0, 0 };
+}
+
+/**
+ * forgets all dirty points, e.g. after a new route has been set. The next
+ * call of every operator is a full scan.
+ */
+void TSPOperatorScheduler::reset(size_t n) {
+    for (int op=0; op<OP_COUNT; op++) {
+        exhausted[op] = false;
+        dirty[op].clear();
+        queued[op].assign(n, 0);
+    }
+}
+
+/**
+ * the route has changed around pointID: all operators have to look at it again.
+ */
+void TSPOperatorScheduler::markDirty(int pointID) {
+    for (int op=0; op<OP_COUNT; op++) {
+        exhausted[op] = false;
+        if ((size_t)pointID >= queued[op].size()) queued[op].resize(pointID + 1, 0);
+        if (queued[op][pointID]) continue;
+        queued[op][pointID] = 1;
+        dirty[op].push_back(pointID);
+    }
+}
+
+/**
+ * @return the next dirty point for op, or -1
+ */
+int TSPOperatorScheduler::nextDirty(int op) {
+    if (dirty[op].empty()) return -1;
+    int p = dirty[op].front();
+    dirty[op].pop_front();
+    queued[op][p] = 0;
+    return p;
+}
+
+/**
+ * UCB1: the operator with the best (normalized) gain per second plus an
+ * exploration bonus for rarely used operators; untried operators first.
+ * @return an operator which is not exhausted, or -1 if all are
+ */
+int TSPOperatorScheduler::pick(void) {
+    double bestRate = 0;
+    for (int op=0; op<OP_COUNT; op++) {
+        if (stats[op].calls == 0) {
+            if (!exhausted[op]) return op;
+            continue;
+        }
+        double rate = stats[op].gain / (stats[op].seconds + 1e-9);
+        if (rate > bestRate) bestRate = rate;
+    }
+    int best = -1;
+    double bestScore = -1;
+    for (int op=0; op<OP_COUNT; op++) {
+        if (exhausted[op]) continue;
+        double rate = stats[op].gain / (stats[op].seconds + 1e-9);
+        double score = ((bestRate > 0) ? rate / bestRate : 0)
+            + SCHEDULER_EXPLORATION * sqrt(log((double)totalCalls + 1) / stats[op].calls);
+        if (score > bestScore) { bestScore = score; best = op; }
+    }
+    return best;
+}
+
+void TSPOperatorScheduler::record(int op, double gain, double seconds) {
+    totalCalls ++;
+    stats[op].calls ++;
+    if (gain > 0) { stats[op].successes ++; stats[op].gain += gain; }
+    stats[op].seconds += seconds;
+}
+
+const char * TSPOperatorScheduler::getName(int op) {
+    switch (op) {
+        case OP_SWAP: return "swap";
+        case OP_UNTANGLE: return "untangle";
+        case OP_SHIFT: return "shift";
+        default: return "?";
+    }
+}
+
+string TSPOperatorScheduler::debug(void) {
+    stringstream ss;
+    ss << "Operator scheduler after " << totalCalls << " calls:" << endl;
+    for (int op=0; op<OP_COUNT; op++) {
+        ss << "  " << getName(op) << ": " << stats[op].calls << " calls, " << stats[op].successes << " successes, ";
+        ss << "gain " << stats[op].gain << " in " << stats[op].seconds << "s";
+        ss << (exhausted[op] ? " (exhausted)" : "") << endl;
+    }
+    return ss.str();
+}
+
 class TSPRouteOptimizer {
 	protected:
     	int verbosity;
     	int successCount;
     	string lastMessage;
+    	char message[256];
+    	TSPMove lastMove;
+    	double lastGain;
+    	// reusable working storage, so that optimizing does not allocate:
+    	TSPRoute scratch;
+    	TSPSplitRoute split;
+    	vector<TSPCrossing> crossings;
+    	vector<int> crossingPoints; // a, b, c, d for each crossing AB x CD
+    	TSPOperatorScheduler scheduler;
+    	TSPThreadPool * pool; // for the full scans, or NULL (one thread)
+    	vector<int> steps; // the route's points in order, for the full scans
+    	TSPRoute * lastResult; // to notice when optimizeStep() is called for a different route
+    	double lastResultLength;
+    	bool deterministic; // charge the operators by work instead of wall-clock time
+    	long long examined; // points looked at by the current runOperator(), one per candidate move
+    	TSPDeadline limits; // see setLimits()
+    	bool trustDirty; // after continueFrom(): an operator is exhausted once its dirty points are (no full scans)
+    	bool inPlace; // see setInPlace()
+    	bool tracing; // see setTracing()
+    	void succeeded(TSPMove m, double gain);
+    	TSPRoute * commitMove(TSPRoute * original, TSPMove m, double gain);
+    	void markTouched(TSPRoute * before, TSPMove m);
+    	TSPRoute * runOperator(int op, TSPRoute * r);
+    	TSPRoute * acceptMove(TSPRoute * original, TSPMove m, double gain, const char * what);
+    	TSPRoute * swapAround(TSPRoute * r, int pointID);
+    	TSPRoute * shiftPoint(TSPRoute * r, int pointID);
+    	TSPRoute * untangleAround(TSPRoute * r, int pointID);
 	public:
-		TSPRouteOptimizer() { successCount=0; verbosity=0; }
+		TSPRouteOptimizer() { successCount=0; verbosity=0; lastMove.type = MOVE_NONE; lastGain = 0; lastResult = NULL; lastResultLength = -1; pool = NULL; deterministic = false; examined = 0; trustDirty = false; inPlace = false; tracing = true; }
+		static void applyMove(TSPRoute * r, TSPMove m, TSPSplitRoute * split);
         TSPRoute * optimizeStep(TSPRoute * r);
 		TSPRoute * switchAnyTwoPoints(TSPRoute * r);
         TSPRoute * moveSinglePoint(TSPRoute * r);
         TSPRoute * moveSinglePointOLD(TSPRoute * r); // the original implementation
         TSPRoute * untangleIntersection(TSPRoute * r);
+        TSPRoute * untangleAll(TSPRoute * r);
+        int twoOptAround(TSPRoute * r, deque<int> & todo, int maxMoves = REPAIR_MAX_MOVES);
         void setVerbosity(int v) { if (v>=0 && v<=2) this->verbosity=v; }
+        void setThreadPool(TSPThreadPool * p) { pool = p; } // parallel full scans (NULL: one thread)
+        void setDeterministic(bool d) { deterministic = d; } // reproducible operator choice, e.g. for --regress
+        void setTracing(bool t) { tracing = t; } // false: the moves stay out of the global trace (for scratch searches)
+        bool isTracing(void) { return tracing; }
+        void setInPlace(bool p) { inPlace = p; } // two-level routes: optimizeStep(r) changes and returns r itself, in O(sqrt(n)) instead of O(n)
+        void setLimits(double seconds, long long evaluations) { limits.set(seconds, evaluations); } // for TSPAnytimeSolver
+        void clearLimits(void) { limits.clear(); trustDirty = false; lastResult = NULL; } // the next optimizeStep() starts over with full scans
+        bool isExpired(void) { return limits.expired(); } // optimizeStep() returned NULL because of the limits?
+        long long getEvaluations(void) { return limits.getSpent(); } // points looked at since setLimits()
+        void continueFrom(TSPRoute * r, const int * touched, int count);
         int getSuccessCount(void) { return successCount; }
+        void setSuccessCount(int n) { successCount = n; } // when resuming from a checkpoint
         string getLastMessage(void) { return lastMessage; }
+        TSPMove getLastMove(void) { return lastMove; }
+        double getLastGain(void) { return lastGain; }
+        TSPOperatorScheduler & getScheduler(void) { return scheduler; }
         ~TSPRouteOptimizer() {}
 };
 
-TSPRoute * TSPRouteOptimizer::optimizeStep(TSPRoute * r) {
-	TSPRoute * candidate = NULL;
+/**
+ * applies a move (as found by one of the optimizers) to r. Also used to replay traces.
+ * @param split working storage for MOVE_UNTANGLE
+ */
+void TSPRouteOptimizer::applyMove(TSPRoute * r, TSPMove m, TSPSplitRoute * split) {
+	switch (m.type) {
+		case MOVE_SWAP:
+			r->moveStepForward(m.i);
+			break;
+		case MOVE_SHIFT:
+			for (int k=0; k<m.j; k++) r->moveStepForward(m.i + k);
+			break;
+		case MOVE_UNTANGLE:
+			split->assign(r, m.i, m.j);
+			split->reverseB();
+			split->joinInto(r);
+			break;
+		case MOVE_TWO_OPT:
+			r->reverseFromTo(m.i, m.j);
+			break;
+		default: break;
+	}
+}
 
-    if (candidate == NULL) {
-		// try to simply switch two connected points:
-		candidate = optimizer->switchAnyTwoPoints(currentRoute);
-    }
+/**
+ * bookkeeping after every successful step.
+ */
+void TSPRouteOptimizer::succeeded(TSPMove m, double gain) {
+	successCount ++;
+	lastMove = m;
+	lastGain = gain;
+	if (tracing && trace != NULL) trace->recordMove(m, gain);
+}
 
-    if (candidate == NULL) {
-    	// try to eliminate an intersection:
-    	candidate = optimizer->untangleIntersection(currentRoute);
-    }
+/**
+ * one improving move, by the operator which the scheduler picks. With limits
+ * (see setLimits()), the operators stop looking once they have expired.
+ * @return a new route (from the route pool) - or r itself, see setInPlace() -
+ * or NULL if r is a local optimum for all operators, or if the limits have
+ * expired (see isExpired())
+ */
+TSPRoute * TSPRouteOptimizer::optimizeStep(TSPRoute * r) {
+	TSP_ZONE("optimizeStep");
+	if (r != lastResult || r->getLength() != lastResultLength) {
+		// not our previous result: start over with full scans
+		scheduler.reset(points.size());
+		trustDirty = false;
+	}
 
-    if (candidate == NULL) {
-    	// try to move any single point anywhere:
-    	candidate = optimizer->moveSinglePoint(currentRoute);
-    }
+	TSPRoute * candidate = NULL;
+	while (candidate == NULL && !limits.expired()) {
+		int op = scheduler.pick();
+		if (op < 0) break; // all operators exhausted
+
+		bool fullScan = !scheduler.hasDirty(op);
+		// wall-clock time: clock() would sum up the threads of the parallel full scans
+		chrono::steady_clock::time_point start = chrono::steady_clock::now();
+		examined = 0;
+		candidate = runOperator(op, r);
+		double seconds = chrono::duration<double>(chrono::steady_clock::now() - start).count();
+		if (deterministic) seconds = examined * 1e-6; // one "microsecond" per point looked at
+		scheduler.record(op, (candidate != NULL) ? lastGain : 0, seconds);
+		limits.charge(examined);
+
+		// (a scan cut short by the limits proves nothing:)
+		if (candidate == NULL && (fullScan || trustDirty) && !limits.expired()) scheduler.setExhausted(op);
+	}
 
-    return candidate;
+	if (candidate != NULL) {
+		lastResult = candidate;
+		lastResultLength = candidate->getLength();
+	}
+	return candidate;
 }
 
-TSPRoute * TSPRouteOptimizer::switchAnyTwoPoints(TSPRoute * original) {
-    TSPRoute * r = original->clone();
-
-    double benchmark = r->getLength();
-    int actualSwitchIdx = -1;
-    double switchLength = benchmark;
+/**
+ * looks at the dirty points of op (if there are any), otherwise runs the full scan.
+ */
+TSPRoute * TSPRouteOptimizer::runOperator(int op, TSPRoute * r) {
+	TSP_ZONE(TSPOperatorScheduler::getName(op));
+	if (!scheduler.hasDirty(op)) {
+		// (the full scans count what they look at themselves)
+		switch (op) {
+			case OP_SWAP: return this->switchAnyTwoPoints(r);
+			case OP_UNTANGLE: return this->untangleIntersection(r);
+			case OP_SHIFT: return this->moveSinglePoint(r);
+			default: return NULL;
+		}
+	}
+	for (int k=0; scheduler.hasDirty(op); k++) {
+		if ((k & 15) == 0 && limits.expired(examined)) return NULL; // the rest stays dirty
+		int p = scheduler.nextDirty(op);
+		TSPRoute * candidate = NULL;
+		switch (op) {
+			case OP_SWAP: candidate = swapAround(r, p); break;
+			case OP_UNTANGLE: candidate = untangleAround(r, p); break;
+			case OP_SHIFT: candidate = shiftPoint(r, p); break;
+		}
+		if (candidate != NULL) return candidate;
+	}
+	return NULL;
+}
 
-    // cout << "Trying to find a shorter route (<" << switchLength << ") by switching any two points:" << endl;
+/**
+ * the following optimizeStep(r) calls only look at the touched points (and
+ * at the points touched by their moves): r must be a local optimum, changed
+ * only around these points, e.g. by a kick of TSPAnytimeSolver. Without the
+ * full scans, the result is only approximately a local optimum again - but
+ * it is found in a fraction of the time. Until clearLimits() or another route.
+ */
+void TSPRouteOptimizer::continueFrom(TSPRoute * r, const int * touched, int count) {
+	scheduler.setLocalOptimum(points.size());
+	for (int k=0; k<count; k++) scheduler.markDirty(touched[k]);
+	trustDirty = true;
+	lastResult = r;
+	lastResultLength = r->getLength();
+}
 
-    for (size_t i=0; i<r->getSize(); i++) {
-        int idxA = r->getStep(i);
-        int idxB = r->getStep(i+1);
+/**
+ * marks the end points of all edges which m (applied to before) removes or adds.
+ */
+void TSPRouteOptimizer::markTouched(TSPRoute * before, TSPMove m) {
+	int positions[6];
+	int count = 0;
+	switch (m.type) {
+		case MOVE_SWAP:
+			for (int k=-1; k<=2; k++) positions[count++] = m.i + k;
+			break;
+		case MOVE_SHIFT:
+			positions[count++] = m.i - 1; positions[count++] = m.i; positions[count++] = m.i + 1;
+			positions[count++] = m.i + m.j; positions[count++] = m.i + m.j + 1;
+			break;
+		case MOVE_UNTANGLE: // split after i and j
+			positions[count++] = m.i; positions[count++] = m.i + 1;
+			positions[count++] = m.j; positions[count++] = m.j + 1;
+			break;
+		case MOVE_TWO_OPT: // reverse i..j
+			positions[count++] = m.i - 1; positions[count++] = m.i;
+			positions[count++] = m.j; positions[count++] = m.j + 1;
+			break;
+		default: break;
+	}
+	for (int k=0; k<count; k++) scheduler.markDirty(before->getStep(positions[k]));
+}
 
-        // try:
-        r->setStep(i, idxB);
-        r->setStep(i+1, idxA);
+/**
+ * applies m to a copy of original - or to original itself, see setInPlace() -
+ * and does the bookkeeping.
+ */
+TSPRoute * TSPRouteOptimizer::commitMove(TSPRoute * original, TSPMove m, double gain) {
+	markTouched(original, m); // by the positions before the move
+	if (!inPlace || !original->isTwoLevel()) {
+		TSPRoute * r = routePool->acquireCopy(original);
+		applyMove(r, m, &split);
+		succeeded(m, gain);
+		return r;
+	}
+	// no O(n) copy and no O(n) length:
+	double length = original->getLength();
+	applyMove(original, m, &split);
+	original->setLength(length - gain);
+	succeeded(m, gain);
+	return original;
+}
 
-        if (r->getLength() < switchLength) {
-            actualSwitchIdx = i;
-            switchLength = r->getLength();
-        }
+/**
+ * commitMove() with a message.
+ */
+TSPRoute * TSPRouteOptimizer::acceptMove(TSPRoute * original, TSPMove m, double gain, const char * what) {
+	int point = original->getStep(m.i);
+	TSPRoute * r = commitMove(original, m, gain);
+
+	snprintf(message, sizeof(message), "Found a shorter (%g) route by %s around point %d.\n", r->getLength(), what, point);
+	if (verbosity > 0) cout << message;
+	lastMessage.assign(message);
+	return r;
+}
 
-        // restore:
-        r->setStep(i, idxA);
-        r->setStep(i+1, idxB);
-    }
+/**
+ * switchAnyTwoPoints(), but only the two swaps which move pointID.
+ */
+TSPRoute * TSPRouteOptimizer::swapAround(TSPRoute * r, int pointID) {
+	int n = r->getSize();
+	if (n < 4) return NULL;
+	int i = r->getIndexOf(pointID);
+	examined += 2;
+	int bestK = -1;
+	double bestGain = 1e-10;
+	for (int k = i - 1; k <= i; k++) {
+		// swap the points at k and k+1:
+		int a = r->getStep(k - 1), b = r->getStep(k), c = r->getStep(k + 1), d = r->getStep(k + 2);
+		double gain = distances->getDistance(a, b) + distances->getDistance(c, d)
+			- distances->getDistance(a, c) - distances->getDistance(b, d);
+		if (gain > bestGain) { bestGain = gain; bestK = k; }
+	}
+	if (bestK < 0) return NULL;
+	TSPMove m = { MOVE_SWAP, (bestK + n) % n, 1 };
+	return acceptMove(r, m, bestGain, "switching two points");
+}
 
-    if (actualSwitchIdx >= 0) {
-		successCount ++;
+/**
+ * moveSinglePoint(), but only for pointID; evaluates every new place by the
+ * changed edges instead of the route length.
+ */
+TSPRoute * TSPRouteOptimizer::shiftPoint(TSPRoute * r, int pointID) {
+	int n = r->getSize();
+	if (n < 4) return NULL;
+	int i = r->getIndexOf(pointID);
+	int a = r->getStep(i - 1), b = r->getStep(i + 1);
+	double removed = distances->getDistance(a, pointID) + distances->getDistance(pointID, b)
+		- distances->getDistance(a, b);
+	examined ++;
+	if (removed <= 1e-10) return NULL;
+	examined += n - 2;
+
+	int bestJ = -1;
+	double bestGain = 1e-10;
+	for (int j=1; j<=n-2; j++) {
+		// moving forward by j positions puts the point between the ones now at i+j and i+j+1:
+		int x = r->getStep(i + j), y = r->getStep(i + j + 1);
+		double gain = removed - (distances->getDistance(x, pointID) + distances->getDistance(pointID, y)
+			- distances->getDistance(x, y));
+		if (gain > bestGain) { bestGain = gain; bestJ = j; }
+	}
+	if (bestJ < 0) return NULL;
+	TSPMove m = { MOVE_SHIFT, i, bestJ };
+	return acceptMove(r, m, bestGain, "moving a point");
+}
 
-        // actually do:
-        int idxA = r->getStep(actualSwitchIdx);
-        int idxB = r->getStep(actualSwitchIdx+1);
+/**
+ * untangleIntersection(), but only for the two segments at pointID.
+ */
+TSPRoute * TSPRouteOptimizer::untangleAround(TSPRoute * r, int pointID) {
+	int n = r->getSize();
+	if (n < 4) return NULL;
+	int i = r->getIndexOf(pointID);
+	examined += 2 * n;
+	int bestP = -1, bestQ = -1;
+	double bestGain = 1e-10;
+	for (int s = i - 1; s <= i; s++) {
+		int p = (s + n) % n;
+		int a = r->getStep(p), b = r->getStep(p + 1);
+		double ax = points.getX(a), ay = points.getY(a), bx = points.getX(b), by = points.getY(b);
+		for (int q=0; q<n; q++) {
+			if (q == p || q == (p + 1) % n || (q + 1) % n == p) continue; // same or adjacent segment
+			int c = r->getStep(q), d = r->getStep(q + 1);
+			if (!TSPRouteAnalyzer::segmentsCross(ax, ay, bx, by, points.getX(c), points.getY(c), points.getX(d), points.getY(d))) continue;
+			double gain = distances->getDistance(a, b) + distances->getDistance(c, d)
+				- distances->getDistance(a, c) - distances->getDistance(b, d);
+			if (gain > bestGain) { bestGain = gain; bestP = min(p, q); bestQ = max(p, q); }
+		}
+	}
+	if (bestP < 0) return NULL;
+	TSPMove m = { MOVE_TWO_OPT, bestP + 1, bestQ };
+	return acceptMove(r, m, bestGain, "untangling");
+}
 
-        r->setStep(actualSwitchIdx, idxB);
-        r->setStep(actualSwitchIdx+1, idxA);
+/**
+ * best-improvement scan over all swaps of two neighbouring points. The gains
+ * come from the changed edges (computed from the coordinates, because the
+ * distance cache is not thread-safe), the positions are split over the
+ * thread pool, if any.
+ */
+TSPRoute * TSPRouteOptimizer::switchAnyTwoPoints(TSPRoute * original) {
+    int n = original->getSize();
+    if (n < 4) return NULL;
+    steps.resize(n);
+    for (int i=0; i<n; i++) steps[i] = original->getStep(i);
+    examined += n;
+
+    TSPScanBest best = parallelBest(pool, n, 1, [&](size_t first, size_t last, TSPScanBest & b) {
+        for (int k=first; k<(int)last; k++) {
+            // swap the points at k and k+1:
+            int pa = steps[(k + n - 1) % n], pb = steps[k], pc = steps[(k + 1) % n], pd = steps[(k + 2) % n];
+            double gain = points.getDistance(pa, pb) + points.getDistance(pc, pd)
+                - points.getDistance(pa, pc) - points.getDistance(pb, pd);
+            if (gain > b.gain && gain > 1e-10) { b.gain = gain; b.i = k; b.j = 1; }
+        }
+    });
+    if (best.i < 0) return NULL;
 
-		stringstream ss;
-		ss << "Found a shorter (" << r->getLength() << ") route in switchAnyTwoPoints: " << idxA << "<->" << idxB << endl;
-		if (verbosity > 0) cout << ss.str();
-		lastMessage = ss.str();
+    // actually do:
+    TSPMove m = { MOVE_SWAP, best.i, 1 };
+    int idxA = steps[best.i];
+    int idxB = steps[(best.i + 1) % n];
+    TSPRoute * r = commitMove(original, m, best.gain);
 
-        if (!r->isComplete()) {
-            throw new runtime_error("switchAnyTwoPoints() produced an incomplete route!"); exit(1);
-        }
+    snprintf(message, sizeof(message), "Found a shorter (%g) route in switchAnyTwoPoints: %d<->%d\n", r->getLength(), idxA, idxB);
+    if (verbosity > 0) cout << message;
+    lastMessage.assign(message);
 
-        return r;
-    } else {
-        // free the unsuccessful temporary route:
-        delete r;
+    if (r != original && !r->isComplete()) {
+        throw new runtime_error("switchAnyTwoPoints() produced an incomplete route!"); exit(1);
     }
-
-    return NULL;
+    return r;
 }
 
+/**
+ * best-improvement scan over all moves of a single point to any other place
+ * in the route, on the changed edges like switchAnyTwoPoints(); the points
+ * to move are split over the thread pool, if any.
+ */
 TSPRoute * TSPRouteOptimizer::moveSinglePoint(TSPRoute * original) {
-    double benchmark = original->getLength();
-    size_t N = original->getSize();
-
-    double bestLength = benchmark;
-    int actualSwitchIdx = -1; // point at this index in the original route should be moved
-    int actualSwitchShift = -1; // ... by this many positions (forward)
-    TSPRoute * bestRoute = NULL;
+    int n = original->getSize();
+    if (n < 4) return NULL;
+    steps.resize(n);
+    for (int i=0; i<n; i++) steps[i] = original->getStep(i);
 
     if (verbosity >= 1) {
 		cout << "Current route: " << original->describe();
-		cout << "Trying to find a shorter route (<" << benchmark << ") by moving any single point anywhere:" << endl;
+		cout << "Trying to find a shorter route (<" << original->getLength() << ") by moving any single point anywhere:" << endl;
     }
 
-    for (size_t i=0; i<N; i++) {
-        int idxA = original->getStep(i);
-        TSPRoute * r = original->clone();
-
-        if (verbosity >= 2) { cout << "  Considering point at #" << i << " which is p" << idxA << endl; }
-        for (size_t j=0; j < N-2; j++) {
-        	r->moveStepForward(i+j);
-        	if (verbosity >= 3) { cout << "Step: The route is now " << r->describePoints(); }
-
-			if (r->getLength() < bestLength) {
-				if (verbosity >= 1) { cout << "    Found a better route! (l=" << r->getLength() << ")" << endl; }
-				bestLength = r->getLength();
-
-				actualSwitchIdx = i;
-				actualSwitchShift = j+1;
-
-				if (bestRoute != NULL) delete bestRoute;
-				bestRoute = r->clone();
-			} else {
-				if (verbosity >= 2) { cout << "    ... not shorter: " << r->getLength() << endl; }
-			}
-        } // next shift amount
-		delete r;
-    } // next focus point
-
-    if (bestRoute != NULL) {
-    	this->successCount ++;
-		stringstream ss;
-		ss << "Found a shorter route in TSPRouteOptimizer::moveSinglePoint()" << endl;
-		ss << "Moving point at " << actualSwitchIdx << " by " << actualSwitchShift << " positions." << endl;
-		if (verbosity >= 2) ss << bestRoute->describe();
-		this->lastMessage = ss.str();
-		if (verbosity >= 1) cout << ss.str();
-
-        if (!bestRoute->isComplete()) {
-            throw new runtime_error("TSPRouteOptimizer::moveSinglePoint() produced an incomplete route!"); exit(1);
+    atomic<long long> looked(0);
+    TSPScanBest best = parallelBest(pool, n, n, [&](size_t first, size_t last, TSPScanBest & b) {
+        long long count = 0;
+        for (int i=first; i<(int)last; i++) {
+            if (limits.expired()) break; // the best move so far is still a valid one
+            int p = steps[i], pa = steps[(i + n - 1) % n], pb = steps[(i + 1) % n];
+            double removed = points.getDistance(pa, p) + points.getDistance(p, pb) - points.getDistance(pa, pb);
+            count ++;
+            if (removed <= b.gain) continue; // cannot beat the best so far
+            count += n - 2;
+            for (int j=1; j<=n-2; j++) {
+                // moving forward by j positions puts the point between the ones now at i+j and i+j+1:
+                int x = steps[(i + j) % n], y = steps[(i + j + 1) % n];
+                double gain = removed - (points.getDistance(x, p) + points.getDistance(p, y) - points.getDistance(x, y));
+                if (gain > b.gain && gain > 1e-10) { b.gain = gain; b.i = i; b.j = j; }
+            }
         }
+        looked += count;
+    });
+    examined += looked;
+    if (best.i < 0) return NULL;
+
+    TSPMove m = { MOVE_SHIFT, best.i, best.j };
+    TSPRoute * bestRoute = commitMove(original, m, best.gain);
+
+	snprintf(message, sizeof(message),
+		"Found a shorter route in TSPRouteOptimizer::moveSinglePoint()\nMoving point at %d by %d positions.\n",
+		best.i, best.j);
+	this->lastMessage.assign(message);
+	if (verbosity >= 2) this->lastMessage += bestRoute->describe();
+	if (verbosity >= 1) cout << this->lastMessage;
+
+    if (bestRoute != original && !bestRoute->isComplete()) {
+        throw new runtime_error("TSPRouteOptimizer::moveSinglePoint() produced an incomplete route!"); exit(1);
     }
 
     return bestRoute;
@@ -606,21 +1152,22 @@ TSPRoute * TSPRouteOptimizer::moveSinglePointOLD(TSPRoute * original) {
 }
 
 TSPRoute * TSPRouteOptimizer::untangleIntersection(TSPRoute * r) {
-	TSPSplitRoute * split = TSPRouteAnalyzer::findIntersections(r);
-
 	// do we even have intersections?
-	if (split == NULL) return NULL;
-
-	this->successCount ++;
+	if (!TSPRouteAnalyzer::findIntersections(r, &split, pool, &limits, &examined)) return NULL;
 
 	// part B of the split routes has already been reversed
-	TSPRoute * retval = split->join();
+	TSPRoute * retval = routePool->acquire();
+	split.joinInto(retval);
 
-	stringstream ss;
-	ss << "Found a shorter route in TSPRouteOptimizer::untangleIntersection()" << endl;
-	ss << split->describe();
-	this->lastMessage = ss.str();
-	if (verbosity >= 1) cout << ss.str();
+	TSPMove m = { MOVE_UNTANGLE, (int)split.getSplitA(), (int)split.getSplitB() };
+	markTouched(r, m);
+	succeeded(m, r->getLength() - retval->getLength());
+
+	this->lastMessage.assign("Found a shorter route in TSPRouteOptimizer::untangleIntersection()\n");
+	if (verbosity >= 1) {
+		this->lastMessage += split.describe();
+		cout << this->lastMessage;
+	}
 
     if (!retval->isComplete()) {
         throw new runtime_error("TSPRouteOptimizer::untangleIntersection() produced an incomplete route!"); exit(1);
@@ -629,15 +1176,128 @@ TSPRoute * TSPRouteOptimizer::untangleIntersection(TSPRoute * r) {
 	return retval;
 }
 
+/**
+ * removes all crossings at once: every crossing AB x CD found by
+ * TSPRouteAnalyzer::findAllCrossings() is replaced by AC and BD (2-opt move),
+ * as long as both segments still exist; repeated until there are no crossings left.
+ * @return a new route (from the route pool), or NULL if there were no crossings
+ */
+TSPRoute * TSPRouteOptimizer::untangleAll(TSPRoute * original) {
+	if (TSPRouteAnalyzer::findAllCrossings(original, crossings) == 0) return NULL;
+
+	TSPRoute * r = routePool->acquireCopy(original);
+	size_t n = r->getSize();
+	int moves = 0, passes = 0;
+	while (!crossings.empty() && passes < UNTANGLE_MAX_PASSES) {
+		passes ++;
+		// remember the points, because the positions change with every reversal:
+		crossingPoints.clear();
+		for (size_t k=0; k<crossings.size(); k++) {
+			crossingPoints.push_back(r->getStep(crossings[k].i));
+			crossingPoints.push_back(r->getStep(crossings[k].i + 1));
+			crossingPoints.push_back(r->getStep(crossings[k].j));
+			crossingPoints.push_back(r->getStep(crossings[k].j + 1));
+		}
+		for (size_t k=0; k<crossingPoints.size(); k+=4) {
+			int seg[2];
+			for (int s=0; s<2; s++) {
+				// where is the segment now (in either direction)?
+				int a = crossingPoints[k + 2*s], b = crossingPoints[k + 2*s + 1];
+				int pa = r->getIndexOf(a);
+				if (r->getStep(pa + 1) == b) seg[s] = pa;
+				else if (r->getStep(pa + n - 1) == b) seg[s] = (pa + n - 1) % n;
+				else seg[s] = -1; // gone
+			}
+			if (seg[0] < 0 || seg[1] < 0 || seg[0] == seg[1]) continue;
+			int i = min(seg[0], seg[1]), j = max(seg[0], seg[1]);
+
+			int a = r->getStep(i), b = r->getStep(i+1), c = r->getStep(j), d = r->getStep(j+1);
+			double gain = distances->getDistance(a, b) + distances->getDistance(c, d)
+				- distances->getDistance(a, c) - distances->getDistance(b, d);
+			if (gain <= 0) continue;
+
+			TSPMove m = { MOVE_TWO_OPT, i + 1, j };
+			applyMove(r, m, &split);
+			succeeded(m, gain);
+			moves ++;
+		}
+		TSPRouteAnalyzer::findAllCrossings(r, crossings);
+	}
+
+	stringstream ss;
+	ss << "Removed crossings with " << moves << " moves in " << passes << " passes, ";
+	ss << crossings.size() << " left." << endl;
+	this->lastMessage = ss.str();
+	if (verbosity >= 1) cout << this->lastMessage;
+
+	if (!r->isComplete()) {
+		throw new runtime_error("TSPRouteOptimizer::untangleAll() produced an incomplete route!"); exit(1);
+	}
+	if (moves == 0) {
+		routePool->release(r);
+		return NULL;
+	}
+	return r;
+}
+
 
+/**
+ * 2-opt with the candidate lists, but only starting from the points in todo
+ * (and the end points of every applied move). Works on r itself; used to
+ * repair the route locally after points have been added or removed.
+ * @return the number of applied moves
+ */
+int TSPRouteOptimizer::twoOptAround(TSPRoute * r, deque<int> & todo, int maxMoves) {
+	int moves = 0;
+	while (!todo.empty() && moves < maxMoves) {
+		int a = todo.front();
+		todo.pop_front();
+		const int * c = candidates->getCandidates(a);
+		bool improved = false;
+		for (int dir=0; dir<2 && !improved; dir++) {
+			int b = (dir == 0) ? r->next(a) : r->prev(a);
+			for (size_t m=0; m<candidates->getK() && !improved; m++) {
+				int cc = c[m];
+				if (cc < 0) break;
+				int e = (dir == 0) ? r->next(cc) : r->prev(cc);
+				if (cc == b || e == a) continue;
+				double gain = distances->getDistance(a, b) + distances->getDistance(cc, e)
+					- distances->getDistance(a, cc) - distances->getDistance(b, e);
+				if (gain <= 1e-10) continue;
+
+				// new edges (a, cc) and (b, e):
+				TSPMove mv = { MOVE_TWO_OPT, r->getIndexOf(b), r->getIndexOf(cc) };
+				if (dir == 1) { mv.i = r->getIndexOf(a); mv.j = r->getIndexOf(e); }
+				applyMove(r, mv, &split);
+				succeeded(mv, gain);
+				moves ++;
+				improved = true;
+				todo.push_back(a); todo.push_back(b); todo.push_back(cc); todo.push_back(e);
+			}
+		}
+	}
+	return moves;
+}
 
+/**
+ * takes ownership of r: it is either kept, or given back to the route pool.
+ */
 void TSPRouteHistory::add(TSPRoute* r) {
 	// do we already have this one?
 	for (size_t i=0; i<this->data->size(); i++) {
 		TSPRoute * other = this->data->at(i);
-		if (r->equals(other)) return; // ignore...
+		if (r->equals(other)) {
+			routePool->release(r); // ignore...
+			return;
+		}
 	}
 	data->push_back(r);
+
+	// forget the oldest route:
+	if (data->size() > HISTORY_MAX) {
+		routePool->release(data->front());
+		data->erase(data->begin());
+	}
 }
 
 void TSPRouteHistory::back(void) {
@@ -646,12 +1306,27 @@ void TSPRouteHistory::back(void) {
 	TSPRoute * r = data->back();
 	if (r == NULL) return; // never set the current route to NULL
 
+	routePool->release(currentRoute);
 	currentRoute = r;
     painter->updateRoute(currentRoute);
+    if (trace != NULL) trace->recordRoute(currentRoute);
 
 	data->pop_back();
 }
 
+/**
+ * forgets all previous routes, e.g. because they belong to another instance.
+ */
+void TSPRouteHistory::clear(void) {
+	for (size_t i=0; i<data->size(); i++) routePool->release(data->at(i));
+	data->clear();
+}
+
+TSPRouteHistory::~TSPRouteHistory(void) {
+	for (size_t i=0; i<data->size(); i++) routePool->release(data->at(i));
+	delete data;
+}
+
 
 
 
@@ -663,36 +1338,25 @@ void TSPRouteHistory::back(void) {
 /////////////////////////////////////////////////////////////////////////////
 
 void createPoints(void) {
-    for (int i=0; i<TSP_N; i++) {
-        double x = 0;
-        for (int j=0; j<12; j++) x += randomDouble();
-        x = (x / 3) - 2; // -2..+2;
-
-        double y = 0;
-        for (int j=0; j<12; j++) y += randomDouble();
-        y = (y / 3) - 2; // -2..+2;
-
-        TSPPoint p(x,y);
-        try{
-            points.at(i) = p;
-		} catch (const out_of_range &ex) {
-            cout << ex.what() << endl;
-        }
-    }
+    TSPInstanceGenerator generator(SEED_POINTS);
+    generator.generate(points, TSP_N, TSP_DISTRIBUTION, threadPool);
 }
 
 void deletePoints(void) {
-//    for (int i=0; i<points.size(); i++) {
-//        delete(points[i]);
-//    }
+    points.resize(0);
 }
 
-void deleteRoutingTable() { delete(routingTable); routingTable = NULL; }
+void deleteDistances() {
+    delete(distances); distances = NULL;
+    delete(candidates); candidates = NULL;
+}
 
 /**
  * sets a new currentRoute and appends the old one (if exists!) to the route history.
+ * @param traced r is the old currentRoute plus the moves which the trace already
+ *        holds (e.g. from optimizeStep()); otherwise r itself is recorded
  */
-void setCurrentRoute(TSPRoute * r) {
+void setCurrentRoute(TSPRoute * r, bool traced = false) {
     if (r == NULL) {
         throw runtime_error("Refusing to set currentRoute to NULL!"); exit(1);
     }
@@ -700,6 +1364,8 @@ void setCurrentRoute(TSPRoute * r) {
         routeHistory->add(currentRoute);
     }
     currentRoute = r;
+    checkpoint->noteRoute(currentRoute);
+    if (trace != NULL && !traced) trace->recordRoute(currentRoute);
 
     painter->updateRoute(currentRoute);
 }
@@ -718,6 +1384,7 @@ void setRandomRoute(void) {
         setCurrentRoute(r);
     } else {
         cout << "Not accepting new route because of length " << r->getLength() << "." << endl;
+        routePool->release(r);
     }
 }
 
@@ -0,0 +1,415 @@
+#ifndef TSP_PARTITION
+#define TSP_PARTITION 1
+
+#include <algorithm> // for std::nth_element()
+
+#define PARTITION_CELL_SIZE 1000 // target number of points per cell
+#define PARTITION_WINDOW 100 // points on each side of a seam which are re-optimized after stitching
+#define LOCAL_SEARCH_K 8 // neighbours per point for TSPLocalSearch
+
+using namespace std;
+
+
+/////////////////////////////////////////////////////////////////////////////
+//                                                                         //
+// CLASSES AND METHODS:                                                    //
+//                                                                         //
+/////////////////////////////////////////////////////////////////////////////
+
+/**
+ * self-contained 2-opt + Or-opt on a small set of points (with their own,
+ * local indices), driven by candidate lists and "don't look" bits. Unlike
+ * TSPRouteOptimizer it uses no global state, so many of them can run in
+ * parallel. One edge can be fixed (it is never removed), which turns the
+ * closed tour into an open path with fixed end points.
+ */
+class TSPLocalSearch {
+    protected:
+        TSPPointStore & pts;
+        TSPCandidateLists cand;
+        size_t m;
+        vector<int> tour;
+        vector<int> pos; // point -> index in tour
+        vector<char> queued;
+        deque<int> queue; // points to look at (don't look bit cleared)
+        int fixedA, fixedB;
+
+        double d(int i, int j) {
+            if ((i == fixedA && j == fixedB) || (i == fixedB && j == fixedA)) return -1e9; // never worth removing
+            return pts.getDistance(i, j);
+        }
+        int next(int c) { return tour[(pos[c] + 1) % m]; }
+        int prev(int c) { return tour[(pos[c] + m - 1) % m]; }
+        void push(int c) { if (!queued[c]) { queued[c] = 1; queue.push_back(c); } }
+        void reversePath(int from, int to);
+        void moveSegment(int s1, int len, int u, bool reversed);
+        bool twoOpt(int a);
+        bool orOpt(int a);
+    public:
+        TSPLocalSearch(TSPPointStore & localPoints, size_t k = LOCAL_SEARCH_K);
+        void setTour(const vector<int> & t);
+        void nearestNeighbourTour(void);
+        void fixEdge(int a, int b) { fixedA = a; fixedB = b; }
+        void optimize(void);
+        const vector<int> & getTour(void) { return tour; }
+};
+
+TSPLocalSearch::TSPLocalSearch(TSPPointStore & localPoints, size_t k) : pts(localPoints), cand(localPoints, k) {
+    m = pts.size();
+    fixedA = -1; fixedB = -1;
+    queued.assign(m, 0);
+}
+
+void TSPLocalSearch::setTour(const vector<int> & t) {
+    tour = t;
+    pos.resize(m);
+    for (size_t i=0; i<m; i++) pos[tour[i]] = i;
+}
+
+/**
+ * greedy start: always go to the nearest unvisited candidate, or (rarely,
+ * if they are all visited) to the nearest unvisited point at all.
+ */
+void TSPLocalSearch::nearestNeighbourTour(void) {
+    vector<char> visited(m, 0);
+    vector<int> t;
+    t.reserve(m);
+    int c = 0;
+    for (size_t step=0; step<m; step++) {
+        t.push_back(c);
+        visited[c] = 1;
+        if (step + 1 == m) break;
+        int best = -1;
+        const int * cc = cand.getCandidates(c);
+        for (size_t q=0; q<cand.getK(); q++) {
+            if (cc[q] >= 0 && !visited[cc[q]]) { best = cc[q]; break; } // sorted by distance
+        }
+        if (best < 0) {
+            double bestD = 1e300;
+            for (size_t i=0; i<m; i++) {
+                if (!visited[i] && pts.getDistance(c, i) < bestD) { bestD = pts.getDistance(c, i); best = i; }
+            }
+        }
+        c = best;
+    }
+    setTour(t);
+}
+
+/**
+ * reverses the tour from point "from" forward to point "to" (or, if that is
+ * shorter, everything else, which results in the same tour).
+ */
+void TSPLocalSearch::reversePath(int from, int to) {
+    size_t i = pos[from], j = pos[to];
+    size_t len = (j + m - i) % m + 1;
+    if (2 * len > m) {
+        size_t ni = (j + 1) % m, nj = (i + m - 1) % m;
+        i = ni; j = nj;
+        len = m - len;
+    }
+    for (size_t k=0; k<len/2; k++) {
+        int a = tour[i], b = tour[j];
+        tour[i] = b; pos[b] = i;
+        tour[j] = a; pos[a] = j;
+        i = (i + 1) % m;
+        j = (j + m - 1) % m;
+    }
+}
+
+/**
+ * moves the len points from s1 forward to between u and its successor, in
+ * place: the shorter of the two stretches between the old and the new place
+ * moves by len positions, O(min) and without allocations.
+ * @param reversed whether the segment is inserted backwards
+ */
+void TSPLocalSearch::moveSegment(int s1, int len, int u, bool reversed) {
+    int seg[3];
+    size_t i0 = pos[s1];
+    for (int k=0; k<len; k++) seg[k] = tour[(i0 + k) % m];
+    if (reversed) std::reverse(seg, seg + len);
+
+    size_t after = (pos[u] + m - i0) % m + 1 - len; // the points after the segment, up to u
+    size_t before = m - len - after; // the points from u's successor up to the segment
+    size_t at; // where the segment goes
+    if (after <= before) {
+        for (size_t k=0; k<after; k++) {
+            int x = tour[(i0 + len + k) % m];
+            tour[(i0 + k) % m] = x; pos[x] = (i0 + k) % m;
+        }
+        at = (i0 + after) % m;
+    } else {
+        at = (i0 + m - before) % m;
+        for (size_t k=before; k-- > 0; ) {
+            int x = tour[(at + k) % m];
+            tour[(at + len + k) % m] = x; pos[x] = (at + len + k) % m;
+        }
+    }
+    for (int k=0; k<len; k++) { tour[(at + k) % m] = seg[k]; pos[seg[k]] = (at + k) % m; }
+}
+
+/**
+ * tries to replace the edge from a to its successor (or predecessor) and one
+ * more edge by two shorter ones.
+ */
+bool TSPLocalSearch::twoOpt(int a) {
+    const int * ca = cand.getCandidates(a);
+    for (int dir=0; dir<2; dir++) {
+        int b = (dir == 0) ? next(a) : prev(a);
+        double dab = d(a, b);
+        for (size_t q=0; q<cand.getK(); q++) {
+            int c = ca[q];
+            if (c < 0) break;
+            double dac = d(a, c);
+            if (dac >= dab) break; // sorted: no gain possible anymore
+            int e = (dir == 0) ? next(c) : prev(c);
+            if (c == b || e == a) continue;
+            double delta = dac + d(b, e) - dab - d(c, e);
+            if (delta > -1e-10) continue;
+
+            // new edges (a,c) and (b,e):
+            if (dir == 0) reversePath(b, c); else reversePath(a, e);
+            push(a); push(b); push(c); push(e);
+            return true;
+        }
+    }
+    return false;
+}
+
+/**
+ * tries to move a segment of 1..3 points, starting at a, between one of its
+ * candidates and that candidate's successor (in either orientation).
+ */
+bool TSPLocalSearch::orOpt(int a) {
+    if (m < 8) return false;
+    int s1 = a, s2 = a;
+    for (int len=1; len<=3; len++) {
+        if (len > 1) s2 = next(s2);
+        int p = prev(s1), nx = next(s2);
+        if (nx == p) return false;
+        double removeGain = d(p, s1) + d(s2, nx) - d(p, nx);
+        if (removeGain <= 1e-10) continue;
+
+        for (int end=0; end<2; end++) {
+            int s = (end == 0) ? s1 : s2;
+            const int * cs = cand.getCandidates(s);
+            for (size_t q=0; q<cand.getK(); q++) {
+                int c = cs[q];
+                if (c < 0) break;
+                if (d(s, c) >= removeGain) break;
+                // c must not be inside the segment:
+                size_t offset = (pos[c] + m - pos[s1]) % m;
+                if (offset < (size_t)len) continue;
+                // insert between c and one of its neighbours, s next to c:
+                for (int side=0; side<2; side++) {
+                    int e = (side == 0) ? next(c) : prev(c);
+                    if ((size_t)((pos[e] + m - pos[s1]) % m) < (size_t)len) continue;
+                    if ((c == p && e == nx) || (c == nx && e == p)) continue; // where it was
+                    int far = (s == s1) ? s2 : s1;
+                    double add = d(c, s) + d(far, e) - d(c, e);
+                    if (add - removeGain > -1e-10) continue;
+
+                    // between c and e, s next to c (u: the one of them which comes first):
+                    int u = (side == 0) ? c : e;
+                    moveSegment(s1, len, u, (u == c) != (s == s1));
+                    push(p); push(nx); push(c); push(e); push(s1); push(s2);
+                    return true;
+                }
+            }
+        }
+    }
+    return false;
+}
+
+void TSPLocalSearch::optimize(void) {
+    if (m < 5) return;
+    queue.clear();
+    queued.assign(m, 0);
+    for (size_t i=0; i<m; i++) push(tour[i]);
+    while (!queue.empty()) {
+        int a = queue.front();
+        queue.pop_front();
+        queued[a] = 0;
+        if (twoOpt(a) || orOpt(a)) push(a);
+    }
+}
+
+
+/**
+ * decomposition for large instances (Karp): the points are split into
+ * balanced k-d cells, every cell is solved on its own (in parallel, on the
+ * thread pool), the cell tours are stitched together in cell order, and
+ * finally the windows around the seams are optimized again (in parallel, too).
+ */
+class TSPPartitionSolver {
+    protected:
+        TSPPointStore & points;
+        size_t n;
+        size_t cellSize;
+        TSPThreadPool * pool;
+        vector<int> ids; // point IDs, each cell contiguous
+        vector<size_t> cellStart; // cell c = ids[cellStart[c] .. cellStart[c+1]-1]
+        string message;
+        void split(size_t from, size_t to, bool flip);
+        void solveCell(size_t c, vector<int> & out);
+        void optimizeWindow(vector<int> & route, size_t center, size_t half);
+    public:
+        TSPPartitionSolver(TSPPointStore & points, TSPThreadPool * pool, size_t cellSize = PARTITION_CELL_SIZE);
+        TSPRoute * solve(void);
+        size_t getCellCount(void) { return cellStart.size() - 1; }
+        string getMessage(void) { return message; }
+};
+
+TSPPartitionSolver::TSPPartitionSolver(TSPPointStore & points, TSPThreadPool * pool, size_t cellSize) : points(points) {
+    this->n = points.size();
+    this->pool = pool;
+    this->cellSize = (cellSize < 8) ? 8 : cellSize;
+}
+
+/**
+ * recursive median split along the longer side of the bounding box. The
+ * order of the two halves alternates, so that consecutive cells are neighbours.
+ */
+void TSPPartitionSolver::split(size_t from, size_t to, bool flip) {
+    if (to - from <= cellSize) {
+        cellStart.push_back(from);
+        return;
+    }
+    double minX = 1e300, maxX = -1e300, minY = 1e300, maxY = -1e300;
+    for (size_t i=from; i<to; i++) {
+        double x = points.getX(ids[i]), y = points.getY(ids[i]);
+        if (x < minX) minX = x;
+        if (x > maxX) maxX = x;
+        if (y < minY) minY = y;
+        if (y > maxY) maxY = y;
+    }
+    bool alongX = (maxX - minX) >= (maxY - minY);
+    size_t mid = from + (to - from) / 2;
+    TSPPointStore & p = points;
+    nth_element(ids.begin() + from, ids.begin() + mid, ids.begin() + to, [&](int a, int b) {
+        return alongX ? p.getX(a) < p.getX(b) : p.getY(a) < p.getY(b);
+    });
+    if (flip) {
+        // the upper half first: swap both halves (they only need to stay contiguous)
+        std::rotate(ids.begin() + from, ids.begin() + mid, ids.begin() + to);
+        mid = from + (to - mid);
+    }
+    split(from, mid, flip);
+    split(mid, to, !flip);
+}
+
+/**
+ * @param out the cell's tour (point IDs)
+ */
+void TSPPartitionSolver::solveCell(size_t c, vector<int> & out) {
+    size_t from = cellStart[c], to = cellStart[c+1];
+    size_t m = to - from;
+    out.assign(ids.begin() + from, ids.begin() + to);
+    if (m < 4) return;
+    if (solveSmall(points, &ids[from], m, &out[0])) return; // small cells: the fixed-size solver
+
+    TSPPointStore local;
+    local.resize(m);
+    for (size_t i=0; i<m; i++) local.set(i, points.getX(ids[from + i]), points.getY(ids[from + i]));
+    TSPLocalSearch search(local);
+    search.nearestNeighbourTour();
+    search.optimize();
+    const vector<int> & t = search.getTour();
+    for (size_t i=0; i<m; i++) out[i] = ids[from + t[i]];
+}
+
+/**
+ * re-optimizes route[center-half .. center+half-1] (wrapping around) as an
+ * open path, i.e. with the outer end points fixed.
+ */
+void TSPPartitionSolver::optimizeWindow(vector<int> & route, size_t center, size_t half) {
+    size_t w = 2 * half;
+    if (w < 8 || w > route.size()) return;
+    size_t first = (center + route.size() - half) % route.size();
+
+    TSPPointStore local;
+    local.resize(w);
+    vector<int> t(w);
+    for (size_t i=0; i<w; i++) {
+        int id = route[(first + i) % route.size()];
+        local.set(i, points.getX(id), points.getY(id));
+        t[i] = i;
+    }
+    TSPLocalSearch search(local);
+    search.setTour(t);
+    search.fixEdge(w - 1, 0); // the closing edge stands for the rest of the route
+    search.optimize();
+
+    // read the path from local point 0 to local point w-1:
+    const vector<int> & opt = search.getTour();
+    size_t p0 = find(opt.begin(), opt.end(), 0) - opt.begin();
+    int step = (opt[(p0 + 1) % w] == (int)w - 1) ? -1 : 1; // do not walk over the fixed edge
+    vector<int> ids(w);
+    for (size_t i=0; i<w; i++) ids[i] = route[(first + i) % route.size()];
+    for (size_t i=0; i<w; i++) {
+        route[(first + i) % route.size()] = ids[opt[(p0 + w + step * (int)i) % w]];
+    }
+}
+
+/**
+ * @return the complete route (from the route pool)
+ */
+TSPRoute * TSPPartitionSolver::solve(void) {
+    sf::Clock clock;
+    ids.resize(n);
+    for (size_t i=0; i<n; i++) ids[i] = i;
+    cellStart.clear();
+    split(0, n, false);
+    cellStart.push_back(n);
+    size_t cells = getCellCount();
+
+    // solve all cells in parallel:
+    vector< vector<int> > tours(cells);
+    pool->parallelFor(cells, [&](size_t c) { solveCell(c, tours[c]); });
+    double tCells = clock.getElapsedTime().asSeconds();
+
+    // stitch: enter each cell at the point closest to where the previous one was left,
+    // and leave it at one of that point's neighbours (in the cell tour)
+    vector<int> route;
+    route.reserve(n);
+    vector<size_t> seams;
+    for (size_t c=0; c<cells; c++) {
+        vector<int> & t = tours[c];
+        size_t m = t.size();
+        if (m == 0) continue;
+        size_t entry = 0;
+        if (!route.empty()) {
+            int last = route.back();
+            double bestD = 1e300;
+            for (size_t i=0; i<m; i++) {
+                double dd = points.getDistance(last, t[i]);
+                if (dd < bestD) { bestD = dd; entry = i; }
+            }
+            seams.push_back(route.size());
+        }
+        // where to go next: the first point of the next cell (or back to the start)
+        int target = (c + 1 < cells) ? tours[c+1][0] : (route.empty() ? t[entry] : route[0]);
+        int fwdEnd = t[(entry + m - 1) % m]; // walking forward drops the edge (entry-1, entry)
+        int bwdEnd = t[(entry + 1) % m]; // walking backward drops the edge (entry, entry+1)
+        double fwd = points.getDistance(fwdEnd, target) - points.getDistance(fwdEnd, t[entry]);
+        double bwd = points.getDistance(bwdEnd, target) - points.getDistance(bwdEnd, t[entry]);
+        int step = (fwd <= bwd) ? 1 : -1;
+        for (size_t i=0; i<m; i++) route.push_back(t[(entry + m + step * (long)i) % m]);
+    }
+    if (cells > 1) seams.push_back(0); // the closing edge, from the last cell to the first
+
+    // re-optimize around the seams (the windows must not overlap):
+    size_t half = PARTITION_WINDOW;
+    if (cells > 1 && half > n / cells / 2) half = n / cells / 2;
+    pool->parallelFor(seams.size(), [&](size_t s) { optimizeWindow(route, seams[s], half); });
+
+    TSPRoute * r = routePool->acquire();
+    for (size_t i=0; i<n; i++) r->addStep(route[i]);
+
+    stringstream ss;
+    ss << "Partitioned " << n << " points into " << cells << " cells, solved on " << pool->getThreadCount();
+    ss << " threads in " << tCells << "s, stitched and re-optimized in " << (clock.getElapsedTime().asSeconds() - tCells) << "s.";
+    message = ss.str();
+    return r;
+}
+
+#endif
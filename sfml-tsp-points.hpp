@@ -0,0 +1,72 @@
+#ifndef TSP_POINTS
+#define TSP_POINTS 1
+
+#include <stdint.h>
+
+using namespace std;
+
+
+/////////////////////////////////////////////////////////////////////////////
+//                                                                         //
+// CLASSES AND METHODS:                                                    //
+//                                                                         //
+/////////////////////////////////////////////////////////////////////////////
+
+/**
+ * contiguous structure-of-arrays store of all point coordinates: x[] and y[]
+ * are separate, aligned arrays, so that the kernels in sfml-tsp-simd.hpp can
+ * process several points at once. Always pass it by reference.
+ */
+class TSPPointStore {
+    protected:
+        vector<double, AlignedAllocator<double> > xs;
+        vector<double, AlignedAllocator<double> > ys;
+    public:
+        TSPPointStore() { }
+        size_t size(void) const { return xs.size(); }
+        void resize(size_t n) { xs.resize(n); ys.resize(n); }
+        void set(size_t i, double x, double y) { xs[i] = x; ys[i] = y; }
+        void add(double x, double y) { xs.push_back(x); ys.push_back(y); }
+        double getX(size_t i) const { return xs[i]; }
+        double getY(size_t i) const { return ys[i]; }
+        const double * getXs(void) const { return xs.data(); }
+        const double * getYs(void) const { return ys.data(); }
+        double getDistance(size_t i, size_t j) const {
+            double dx = xs[i] - xs[j];
+            double dy = ys[i] - ys[j];
+            return sqrt(dx*dx + dy*dy);
+        }
+        double getDistanceTo(size_t i, double x, double y) const {
+            double dx = xs[i] - x;
+            double dy = ys[i] - y;
+            return sqrt(dx*dx + dy*dy);
+        }
+        /**
+         * out[k] = distance from point #i to point #(from+k), for all points from..to-1
+         */
+        void fillDistances(size_t i, size_t from, size_t to, double * out) const {
+            simdDistanceRow(xs.data() + from, ys.data() + from, to - from, xs[i], ys[i], out);
+        }
+        int findClosest(double x, double y) const { return simdNearest(xs.data(), ys.data(), size(), x, y); }
+        double getTourLength(const int * seq, size_t n) const { return simdTourLength(xs.data(), ys.data(), seq, n); }
+        /**
+         * FNV-1a hash of all coordinates, identifies the instance (e.g. in checkpoints)
+         */
+        uint64_t getHash(void) const {
+            uint64_t h = 14695981039346656037ULL;
+            for (size_t i=0; i<size(); i++) {
+                const unsigned char * bx = (const unsigned char *)&xs[i];
+                const unsigned char * by = (const unsigned char *)&ys[i];
+                for (size_t b=0; b<sizeof(double); b++) { h ^= bx[b]; h *= 1099511628211ULL; }
+                for (size_t b=0; b<sizeof(double); b++) { h ^= by[b]; h *= 1099511628211ULL; }
+            }
+            return h;
+        }
+        string describe(size_t i) const {
+            stringstream ss;
+            ss << "TSPPoint(" << xs[i] << ";" << ys[i] << ")";
+            return ss.str();
+        }
+};
+
+#endif
@@ -0,0 +1,139 @@
+#ifndef TSP_PROFILE_ZONES
+#define TSP_PROFILE_ZONES 1
+
+#include <chrono>
+#include <mutex>
+
+#define PROFILE_FILE "sfml-tsp.profile.json" // Chrome trace event format, e.g. for https://ui.perfetto.dev
+#define PROFILE_RING_SIZE 65536 // zones kept per thread (the oldest are overwritten)
+
+using namespace std;
+
+
+/////////////////////////////////////////////////////////////////////////////
+//                                                                         //
+// TIMING ZONES:                                                           //
+//                                                                         //
+/////////////////////////////////////////////////////////////////////////////
+
+/**
+ * TSP_ZONE("name") times the rest of the enclosing block. Only if compiled
+ * with -DTSP_PROFILE; otherwise it expands to nothing. The name must be a
+ * string literal (or another string that lives forever).
+ */
+#ifdef TSP_PROFILE
+
+#define TSP_ZONE_CONCAT2(a, b) a##b
+#define TSP_ZONE_CONCAT(a, b) TSP_ZONE_CONCAT2(a, b)
+#define TSP_ZONE(name) TSPZone TSP_ZONE_CONCAT(tspZone, __LINE__)(name)
+
+/**
+ * the zones of one thread; only that thread writes to it
+ */
+struct TSPZoneRing {
+    struct Zone {
+        const char * name;
+        int64_t start; // ns since profiler.epoch
+        int64_t duration;
+    };
+    int threadID;
+    Zone zones[PROFILE_RING_SIZE];
+    atomic<uint64_t> count; // zones ever written
+};
+
+class TSPProfiler {
+    protected:
+        mutex lock;
+        vector<TSPZoneRing *> rings;
+    public:
+        chrono::steady_clock::time_point epoch;
+        TSPProfiler() { epoch = chrono::steady_clock::now(); }
+        ~TSPProfiler() { for (size_t i=0; i<rings.size(); i++) delete rings[i]; }
+        TSPZoneRing * getRing(void);
+        bool writeChromeTrace(string filename);
+};
+
+TSPProfiler profiler;
+
+/**
+ * @return the calling thread's ring (created and registered on first use)
+ */
+TSPZoneRing * TSPProfiler::getRing(void) {
+    static thread_local TSPZoneRing * ring = NULL;
+    if (ring == NULL) {
+        ring = new TSPZoneRing();
+        ring->count = 0;
+        lock_guard<mutex> guard(lock);
+        ring->threadID = rings.size();
+        rings.push_back(ring);
+    }
+    return ring;
+}
+
+/**
+ * writes all recorded zones as complete ("X") events. Zones which are
+ * written by other threads at the same time may be missing.
+ */
+bool TSPProfiler::writeChromeTrace(string filename) {
+    FILE * f = fopen(filename.c_str(), "w");
+    if (f == NULL) {
+        cout << "Could not write profile: " << filename << endl;
+        return false;
+    }
+    lock_guard<mutex> guard(lock);
+    fprintf(f, "{\"traceEvents\":[\n");
+    bool first = true;
+    size_t total = 0;
+    for (size_t r=0; r<rings.size(); r++) {
+        TSPZoneRing * ring = rings[r];
+        uint64_t count = ring->count;
+        uint64_t from = (count > PROFILE_RING_SIZE) ? count - PROFILE_RING_SIZE : 0;
+        for (uint64_t k=from; k<count; k++) {
+            const TSPZoneRing::Zone & z = ring->zones[k % PROFILE_RING_SIZE];
+            fprintf(f, "%s{\"name\":\"%s\",\"ph\":\"X\",\"pid\":1,\"tid\":%d,\"ts\":%.3f,\"dur\":%.3f}",
+                first ? "" : ",\n", z.name, ring->threadID, z.start / 1000.0, z.duration / 1000.0);
+            first = false;
+            total ++;
+        }
+    }
+    fprintf(f, "\n]}\n");
+    bool ok = (fclose(f) == 0);
+    if (ok) cout << "Wrote " << total << " zones to " << filename << "." << endl;
+    return ok;
+}
+
+/**
+ * one timed zone: from construction to the end of the scope
+ */
+class TSPZone {
+    protected:
+        const char * name;
+        chrono::steady_clock::time_point start;
+    public:
+        TSPZone(const char * name) { this->name = name; start = chrono::steady_clock::now(); }
+        ~TSPZone() {
+            chrono::steady_clock::time_point end = chrono::steady_clock::now();
+            TSPZoneRing * ring = profiler.getRing();
+            uint64_t k = ring->count;
+            TSPZoneRing::Zone & z = ring->zones[k % PROFILE_RING_SIZE];
+            z.name = name;
+            z.start = chrono::duration_cast<chrono::nanoseconds>(start - profiler.epoch).count();
+            z.duration = chrono::duration_cast<chrono::nanoseconds>(end - start).count();
+            ring->count.store(k + 1, memory_order_release);
+        }
+};
+
+bool writeProfile(string filename) { return profiler.writeChromeTrace(filename); }
+
+#else
+
+#define TSP_ZONE(name)
+
+bool writeProfile(string filename) {
+    cout << "Profiling is not compiled in (build with -DTSP_PROFILE)." << endl;
+    return false;
+}
+
+#endif
+
+#endif
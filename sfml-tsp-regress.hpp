@@ -0,0 +1,299 @@
+#ifndef TSP_REGRESS
+#define TSP_REGRESS 1
+
+#include <fstream>
+#include <map>
+
+#define REGRESS_GOLDENS "data/regress-goldens.txt" // relative to the working directory, like CHECKPOINT_FILE
+#define REGRESS_EXACT_MAX_N 16 // instances up to this size also run (and are measured against) the exact DP
+#define REGRESS_GAP 0.10 // "time to gap": until the route is within 10% of the reference
+#define REGRESS_QUALITY_TOLERANCE 0.01 // fail if a route is more than 1% longer than its golden
+#define REGRESS_TIME_FACTOR 2.0 // report (--regress-timing: fail) if a run takes more than twice its golden time ...
+#define REGRESS_TIME_SLACK 0.05 // ... plus this many seconds (timer noise on tiny runs)
+#define REGRESS_MEMORY_FACTOR 1.25 // fail if the peak memory grows by more than 25% ...
+#define REGRESS_MEMORY_SLACK 65536 // ... plus this many bytes
+
+using namespace std;
+
+
+/////////////////////////////////////////////////////////////////////////////
+//                                                                         //
+// CLASSES AND METHODS:                                                    //
+//                                                                         //
+/////////////////////////////////////////////////////////////////////////////
+
+/**
+ * one instance of the regression corpus: a TSPLIB file, or generated points
+ */
+struct TSPRegressCase {
+    const char * name;
+    const char * file; // NULL: generated
+    TSPDistribution distribution;
+    size_t n;
+    uint64_t seed;
+    double optimum; // the published optimum in the file's metric (TSPLIB), or 0
+};
+
+static const TSPRegressCase REGRESS_CORPUS[] = {
+    { "burma14", "data/tsplib/burma14.tsp", DIST_UNIFORM, 0, 0, 3323 },
+    { "ulysses16", "data/tsplib/ulysses16.tsp", DIST_UNIFORM, 0, 0, 6859 },
+    { "blob-40", NULL, DIST_BLOB, 40, 4, 0 },
+    { "blob-200", NULL, DIST_BLOB, 200, 1, 0 },
+    { "uniform-1000", NULL, DIST_UNIFORM, 1000, 2, 0 },
+    { "clustered-1000", NULL, DIST_CLUSTERED, 1000, 3, 0 },
+};
+
+/**
+ * the measurements of one pipeline on one instance (also the golden values)
+ */
+struct TSPRegressResult {
+    double length;
+    double seconds;
+    double gapSeconds; // time until within REGRESS_GAP of the reference, -1 if never
+    long long peakBytes; // TSPMemoryStats::getPeak() during the run
+};
+
+/**
+ * end-to-end regression run (command line: --regress): every instance of
+ * REGRESS_CORPUS goes through every construction + optimization pipeline
+ * (the fixed-size "small" one only up to SMALL_MAX_N points).
+ * The results are compared with the goldens in REGRESS_GOLDENS; --regress-update
+ * writes the current results as the new goldens instead. Length and peak
+ * memory are the hard checks; the times of the goldens belong to the machine
+ * which wrote them, so slower runs are only reported (unless the timing is
+ * strict: --regress-timing, on that machine).
+ * The reference of the gap is the exact optimum (up to REGRESS_EXACT_MAX_N
+ * points) or the Held-Karp lower bound. TSPLIB instances with another metric
+ * than Euclidean also go through "exact/<metric>" and "small/<metric>", whose
+ * lengths are in that metric: the exact one has to hit the published optimum.
+ */
+class TSPRegression {
+    protected:
+        map<string, TSPRegressResult> goldens; // key: instance + " " + pipeline
+        map<string, TSPRegressResult> results;
+        vector<string> order; // of the results
+        int failures;
+        bool strictTiming; // slower runs fail, too
+        double reference;
+        TSPMetric metric; // of the current instance
+        bool loadInstance(const TSPRegressCase & c);
+        void runCase(const TSPRegressCase & c);
+        TSPRegressResult runPipeline(const string & pipeline, TSPMetric m = METRIC_EUCLIDEAN);
+        TSPRegressResult optimize(TSPRoute * r, sf::Clock & clock);
+        void check(const string & key, const TSPRegressResult & now);
+    public:
+        TSPRegression() { failures = 0; strictTiming = false; reference = 0; metric = METRIC_EUCLIDEAN; }
+        void setStrictTiming(bool strict) { strictTiming = strict; }
+        bool loadGoldens(string filename);
+        bool saveGoldens(string filename);
+        bool run(void); // true if nothing regressed
+        int getFailures(void) { return failures; }
+};
+
+bool TSPRegression::loadGoldens(string filename) {
+    ifstream in(filename.c_str());
+    if (!in) return false;
+    string line;
+    while (getline(in, line)) {
+        if (line.empty() || line[0] == '#') continue;
+        stringstream ss(line);
+        string instance, pipeline;
+        TSPRegressResult g;
+        if (ss >> instance >> pipeline >> g.length >> g.seconds >> g.gapSeconds >> g.peakBytes) {
+            goldens[instance + " " + pipeline] = g;
+        }
+    }
+    return true;
+}
+
+bool TSPRegression::saveGoldens(string filename) {
+    ofstream out(filename.c_str());
+    if (!out) {
+        cout << "Could not write goldens: " << filename << endl;
+        return false;
+    }
+    out << "# sfml-tsp --regress goldens (written by --regress-update):" << endl;
+    out << "# instance pipeline length seconds gap-seconds peak-bytes" << endl;
+    char buf[256];
+    for (size_t i=0; i<order.size(); i++) {
+        const TSPRegressResult & r = results[order[i]];
+        snprintf(buf, sizeof(buf), "%s %.6f %.4f %.4f %lld", order[i].c_str(), r.length, r.seconds, r.gapSeconds, r.peakBytes);
+        out << buf << endl;
+    }
+    cout << "Wrote " << order.size() << " goldens to " << filename << "." << endl;
+    return true;
+}
+
+/**
+ * sets up the global points, distances and candidate lists for c.
+ */
+bool TSPRegression::loadInstance(const TSPRegressCase & c) {
+    metric = METRIC_EUCLIDEAN;
+    if (c.file != NULL) {
+        TSPLibFile f;
+        if (!f.load(c.file, points)) {
+            cout << f.getMessage() << endl;
+            return false;
+        }
+        metric = metricFromTSPLib(f.getEdgeWeightType());
+    } else {
+        TSPInstanceGenerator(c.seed).generate(points, c.n, c.distribution, threadPool);
+    }
+    distances = new TSPRoutingTable(points);
+    candidates = new TSPCandidateLists(points, CANDIDATES_K);
+    return true;
+}
+
+bool TSPRegression::run(void) {
+    failures = 0;
+    cout << "instance       pipeline       length       gap   seconds  to " << (int)(REGRESS_GAP * 100) << "% gap     peak" << endl;
+    for (size_t i=0; i<sizeof(REGRESS_CORPUS) / sizeof(REGRESS_CORPUS[0]); i++) {
+        const TSPRegressCase & c = REGRESS_CORPUS[i];
+        if (!loadInstance(c)) {
+            failures ++;
+            continue;
+        }
+        runCase(c);
+        deleteDistances();
+        deletePoints();
+    }
+    return failures == 0;
+}
+
+void TSPRegression::runCase(const TSPRegressCase & c) {
+    // the reference for the gap:
+    reference = 0;
+    if (points.size() <= REGRESS_EXACT_MAX_N) {
+        TSPRegressResult exact = runPipeline("exact");
+        reference = exact.length;
+        check(string(c.name) + " exact", exact);
+    } else {
+        TSPRoute * upper = TSPRouter::naiveClosest();
+        TSPLowerBound bound(points, distances, candidates);
+        reference = bound.compute(upper->getLength());
+        routePool->release(upper);
+    }
+
+    const char * pipelines[] = { "random+opt", "closest+opt", "partition", "small" };
+    for (int p=0; p<4; p++) {
+        if (string(pipelines[p]) == "small" && points.size() > SMALL_MAX_N) continue;
+        check(string(c.name) + " " + pipelines[p], runPipeline(pipelines[p]));
+    }
+
+    if (metric == METRIC_EUCLIDEAN) return;
+    // in the file's own metric:
+    reference = c.optimum;
+    string suffix = string("/") + getMetricName(metric);
+    if (points.size() <= REGRESS_EXACT_MAX_N) {
+        TSPRegressResult exact = runPipeline("exact", metric);
+        check(string(c.name) + " exact" + suffix, exact);
+        if (c.optimum > 0 && exact.length != c.optimum) {
+            cout << "FAIL: the published optimum of " << c.name << " is " << c.optimum << endl;
+            failures ++;
+        }
+    }
+    if (points.size() <= SMALL_MAX_N) check(string(c.name) + " small" + suffix, runPipeline("small", metric));
+}
+
+/**
+ * @param m the metric of the exact and small pipelines (and of the length)
+ */
+TSPRegressResult TSPRegression::runPipeline(const string & pipeline, TSPMetric m) {
+    TSPRegressResult result = { 0, 0, -1, 0 };
+    memoryStats.resetPeaks();
+    sf::Clock clock;
+    TSPRoute * r = NULL;
+    if (pipeline == "exact") {
+        TSPExactSolver solver(points, vector<int>(), m);
+        r = solver.solveDP();
+    } else if (pipeline == "random+opt") {
+        seedRandom(SEED_ROUTE);
+        result = optimize(TSPRouter::naiveRandom(), clock);
+    } else if (pipeline == "closest+opt") {
+        result = optimize(TSPRouter::naiveClosest(), clock);
+    } else if (pipeline == "partition") {
+        TSPPartitionSolver solver(points, threadPool);
+        r = solver.solve();
+    } else if (pipeline == "small") {
+        vector<int> seq(points.size());
+        solveSmall(points, NULL, seq.size(), &seq[0], m);
+        r = routePool->acquire();
+        for (size_t i=0; i<seq.size(); i++) r->addStep(seq[i]);
+    }
+    if (r != NULL) {
+        result.length = r->getLength();
+        if (m != METRIC_EUCLIDEAN) {
+            vector<int> seq(r->getSize());
+            for (size_t i=0; i<seq.size(); i++) seq[i] = r->getStep(i);
+            result.length = metricTourLength(m, points, &seq[0], seq.size());
+        }
+        result.seconds = clock.getElapsedTime().asSeconds();
+        if (reference <= 0 || result.length <= reference * (1 + REGRESS_GAP)) result.gapSeconds = result.seconds;
+        routePool->release(r);
+    }
+    result.peakBytes = memoryStats.getPeak();
+    return result;
+}
+
+/**
+ * optimizes r (released afterwards) until a local optimum.
+ */
+TSPRegressResult TSPRegression::optimize(TSPRoute * r, sf::Clock & clock) {
+    TSPRegressResult result = { 0, 0, -1, 0 };
+    TSPRouteOptimizer opt;
+    opt.setThreadPool(threadPool);
+    opt.setDeterministic(true);
+    opt.setInPlace(true);
+    while (true) {
+        if (result.gapSeconds < 0 && r->getLength() <= reference * (1 + REGRESS_GAP)) {
+            result.gapSeconds = clock.getElapsedTime().asSeconds();
+        }
+        TSPRoute * better = opt.optimizeStep(r);
+        if (better == NULL) break;
+        if (better != r) routePool->release(r);
+        r = better;
+    }
+    result.length = r->getLength();
+    result.seconds = clock.getElapsedTime().asSeconds();
+    routePool->release(r);
+    return result;
+}
+
+/**
+ * prints one line and compares it with the golden (if there is one).
+ */
+void TSPRegression::check(const string & key, const TSPRegressResult & now) {
+    results[key] = now;
+    order.push_back(key);
+
+    string verdict = "new";
+    map<string, TSPRegressResult>::iterator it = goldens.find(key);
+    if (it != goldens.end()) {
+        const TSPRegressResult & g = it->second;
+        stringstream problems, timing;
+        if (now.length > g.length * (1 + REGRESS_QUALITY_TOLERANCE)) problems << " longer(" << g.length << ")";
+        if (now.peakBytes > g.peakBytes * REGRESS_MEMORY_FACTOR + REGRESS_MEMORY_SLACK) {
+            problems << " memory(" << TSPMemoryStats::formatBytes(g.peakBytes) << ")";
+        }
+        if (now.seconds > g.seconds * REGRESS_TIME_FACTOR + REGRESS_TIME_SLACK) timing << " slower(" << g.seconds << "s)";
+        if (g.gapSeconds >= 0 && (now.gapSeconds < 0 || now.gapSeconds > g.gapSeconds * REGRESS_TIME_FACTOR + REGRESS_TIME_SLACK)) {
+            timing << " gap-slower(" << g.gapSeconds << "s)";
+        }
+        if (strictTiming) problems << timing.str();
+        verdict = problems.str().empty() ? "ok" : "FAIL" + problems.str();
+        if (!problems.str().empty()) failures ++;
+        else if (!timing.str().empty()) verdict += timing.str(); // reported only
+    }
+
+    char buf[256];
+    size_t space = key.find(' ');
+    char gapSeconds[16] = "-";
+    if (now.gapSeconds >= 0) snprintf(gapSeconds, sizeof(gapSeconds), "%.3fs", now.gapSeconds);
+    snprintf(buf, sizeof(buf), "%-14s %-12s %10.4f %8.2f%% %8.3fs %10s %8s  ",
+        key.substr(0, space).c_str(), key.substr(space + 1).c_str(), now.length,
+        (reference > 0) ? 100 * (now.length / reference - 1) : 0.0, now.seconds, gapSeconds,
+        TSPMemoryStats::formatBytes(now.peakBytes).c_str());
+    cout << buf << verdict << endl;
+}
+
+#endif
@@ -0,0 +1,595 @@
+#ifndef TSP_SERVER
+#define TSP_SERVER 1
+
+#include <stdint.h>
+#include <cstring>
+#include <cerrno>
+#include <map>
+#include <thread>
+#include <sys/socket.h>
+#include <sys/un.h>
+#include <poll.h>
+#include <fcntl.h>
+#include <unistd.h>
+
+#define SERVER_SOCKET "sfml-tsp.sock" // relative to the working directory, like CHECKPOINT_FILE
+#define SERVER_MAX_N (1 << 20) // larger requests are refused (and the connection closed)
+#define SERVER_BATCH_MAX 256 // small instances solved together on the thread pool
+#define SERVER_CACHE_BYTES (512ULL << 20) // preprocessed instances kept (least recently used ones are dropped)
+#define SERVER_READ_SIZE 65536
+#define SERVER_OUT_MAX (64 << 20) // a client with this many unread reply bytes is not read from until it catches up
+
+using namespace std;
+
+
+/////////////////////////////////////////////////////////////////////////////
+//                                                                         //
+// CLASSES AND METHODS:                                                    //
+//                                                                         //
+/////////////////////////////////////////////////////////////////////////////
+
+/**
+ * framing (native byte order, the socket is local): every request is a
+ * TSPServerRequest followed by n (x, y) pairs of doubles; every reply is a
+ * TSPServerReply followed by the route as n int32 point IDs (0..n-1). size
+ * counts the bytes after the size field. Replies come in the order in which
+ * the requests are solved, not necessarily in the order they were sent.
+ */
+struct TSPServerRequest {
+    uint32_t size;
+    uint32_t kind; // TSPServerKind
+    uint32_t id; // chosen by the client, repeated in the reply
+    uint32_t n;
+    uint32_t metric; // TSPMetric (only METRIC_EUCLIDEAN above SMALL_MAX_N)
+    uint32_t reserved;
+    double seconds; // deadline for TSPAnytimeSolver (<= 0: the first local optimum)
+    double targetGap; // stop early within this gap to the lower bound, e.g. 0.005 (<= 0: none; only up to BOUND_AUTO_MAX_N points)
+};
+
+struct TSPServerReply {
+    uint32_t size;
+    uint32_t id;
+    uint32_t status; // TSPServerStatus; the route only with SERVER_OK
+    uint32_t n;
+    double length; // in the requested metric
+    double seconds; // from receiving the request to sending the reply
+};
+
+enum TSPServerKind {
+    SERVER_SOLVE = 1,
+    SERVER_SHUTDOWN = 2 // answer the queued requests, then stop
+};
+
+enum TSPServerStatus {
+    SERVER_OK = 0,
+    SERVER_BAD_REQUEST = 1,
+    SERVER_UNSUPPORTED = 2 // e.g. an integer metric for a large instance
+};
+
+/**
+ * blocking (for the client); false if the other side has gone
+ */
+bool serverWriteAll(int fd, const void * data, size_t size) {
+    const char * p = (const char *)data;
+    while (size > 0) {
+        ssize_t written = send(fd, p, size, MSG_NOSIGNAL);
+        if (written <= 0) return false;
+        p += written; size -= written;
+    }
+    return true;
+}
+
+bool serverReadAll(int fd, void * data, size_t size) {
+    char * p = (char *)data;
+    while (size > 0) {
+        ssize_t got = read(fd, p, size);
+        if (got <= 0) return false;
+        p += got; size -= got;
+    }
+    return true;
+}
+
+/**
+ * a long-running solver on a Unix domain socket: reads requests from any
+ * number of clients, queues them, and answers
+ * - small instances (up to SMALL_MAX_N points) in batches on the thread
+ *   pool, with solveSmall() (which does not touch the globals),
+ * - larger ones one at a time with TSPAnytimeSolver on the global instance.
+ *   The routing table and candidate lists of every instance are cached by
+ *   its content hash (TSPPointStore::getHash()), together with the best
+ *   route so far, so that sending an instance again costs no preprocessing
+ *   and continues from its best route. With a target gap, the Held-Karp
+ *   bound (up to BOUND_AUTO_MAX_N points, cached as well) ends the search
+ *   as soon as the route is close enough to it.
+ * One thread polls all sockets; the small batch goes first, then at most one
+ * large instance, so that small requests do not wait behind many large ones.
+ * The client sockets are non-blocking: replies go into the output buffer of
+ * the connection and are sent when the socket can take them, so a client
+ * which does not read its replies cannot stall the others. A client which
+ * half-closes its socket after sending still gets all of its replies; when
+ * it is gone completely, its queued requests are dropped.
+ */
+class TSPServer {
+    protected:
+        struct Connection {
+            int fd;
+            vector<char> in; // received, not yet complete requests
+            vector<char> out; // replies, not yet sent from outStart on
+            size_t outStart;
+            bool readDone; // the client has half-closed: closed as soon as all its replies are sent
+        };
+        struct Request {
+            int connection;
+            TSPServerRequest head;
+            TSPPointStore points;
+            chrono::steady_clock::time_point received;
+        };
+        struct CacheEntry {
+            TSPPointStore points;
+            uint64_t hash;
+            TSPDistanceProvider * distances;
+            TSPCandidateLists * candidates;
+            vector<int> best; // the best route so far (empty: none)
+            double bestLength;
+            double bound; // Held-Karp lower bound, -1: not computed (yet)
+            size_t bytes;
+            uint64_t lastUse;
+        };
+        string path;
+        int listenFD;
+        map<int, Connection> connections; // by connection number (file descriptors are reused)
+        int nextConnection;
+        deque<Request> queue;
+        vector<CacheEntry *> cache;
+        size_t cacheBytes;
+        uint64_t useCounter;
+        bool stopping;
+        TSPRouteOptimizer optimizer;
+        size_t solved, batches, cacheHits, cacheMisses;
+        bool listen(void);
+        void accept(void);
+        bool receive(int connection);
+        bool flush(int connection);
+        bool hasPendingOutput(void);
+        void closeFinished(void);
+        void process(void);
+        void solveBatch(vector<Request> & batch);
+        void solveLarge(Request & r);
+        CacheEntry * prepare(const TSPPointStore & p);
+        void reply(const Request & r, uint32_t status, const int * order, size_t n, double length);
+        void close(int connection);
+    public:
+        TSPServer(string path) {
+            this->path = path; listenFD = -1; nextConnection = 0;
+            cacheBytes = 0; useCounter = 0; stopping = false;
+            solved = 0; batches = 0; cacheHits = 0; cacheMisses = 0;
+            optimizer.setThreadPool(threadPool);
+        }
+        ~TSPServer();
+        int run(void);
+        string debug(void);
+};
+
+TSPServer::~TSPServer() {
+    for (map<int, Connection>::iterator it = connections.begin(); it != connections.end(); ++it) ::close(it->second.fd);
+    if (listenFD >= 0) { ::close(listenFD); unlink(path.c_str()); }
+    for (size_t i=0; i<cache.size(); i++) {
+        delete cache[i]->distances;
+        delete cache[i]->candidates;
+        delete cache[i];
+    }
+    distances = NULL; candidates = NULL; // they belonged to the cache
+}
+
+bool TSPServer::listen(void) {
+    struct sockaddr_un address;
+    memset(&address, 0, sizeof(address));
+    address.sun_family = AF_UNIX;
+    if (path.size() >= sizeof(address.sun_path)) {
+        cout << "Socket path too long: " << path << endl;
+        return false;
+    }
+    strcpy(address.sun_path, path.c_str());
+    unlink(path.c_str()); // left over from a previous run
+
+    listenFD = socket(AF_UNIX, SOCK_STREAM, 0);
+    if (listenFD < 0 || bind(listenFD, (struct sockaddr *)&address, sizeof(address)) != 0 || ::listen(listenFD, 16) != 0) {
+        cout << "Could not listen on " << path << ": " << strerror(errno) << endl;
+        return false;
+    }
+    return true;
+}
+
+void TSPServer::accept(void) {
+    int fd = ::accept(listenFD, NULL, NULL);
+    if (fd < 0) return;
+    fcntl(fd, F_SETFL, fcntl(fd, F_GETFL, 0) | O_NONBLOCK);
+    Connection c;
+    c.fd = fd;
+    c.outStart = 0;
+    c.readDone = false;
+    connections[nextConnection++] = c;
+}
+
+/**
+ * the client has gone (or misbehaved): its queued requests are dropped, too.
+ */
+void TSPServer::close(int connection) {
+    map<int, Connection>::iterator it = connections.find(connection);
+    if (it == connections.end()) return;
+    ::close(it->second.fd);
+    connections.erase(it);
+
+    size_t dropped = 0;
+    for (deque<Request>::iterator q = queue.begin(); q != queue.end(); ) {
+        if (q->connection == connection) { q = queue.erase(q); dropped ++; }
+        else ++q;
+    }
+    if (dropped > 0) cout << "Connection " << connection << " has gone, dropped its " << dropped << " queued requests." << endl;
+}
+
+/**
+ * closes the half-closed connections which have nothing queued or unsent anymore.
+ */
+void TSPServer::closeFinished(void) {
+    for (map<int, Connection>::iterator it = connections.begin(); it != connections.end(); ) {
+        int number = it->first;
+        Connection & c = it->second;
+        ++it;
+        if (!c.readDone || c.outStart < c.out.size()) continue;
+        bool queued = false;
+        for (size_t q=0; q<queue.size() && !queued; q++) queued = (queue[q].connection == number);
+        if (!queued) close(number);
+    }
+}
+
+/**
+ * reads what is available and queues all complete requests. At the end of
+ * the stream (the client has half-closed), an incomplete request is dropped.
+ * @return false if the connection is broken (or sent garbage)
+ */
+bool TSPServer::receive(int connection) {
+    Connection & c = connections[connection];
+    size_t old = c.in.size();
+    c.in.resize(old + SERVER_READ_SIZE);
+    ssize_t got = read(c.fd, &c.in[old], SERVER_READ_SIZE);
+    if (got < 0) {
+        if (errno != EAGAIN && errno != EWOULDBLOCK && errno != EINTR) return false;
+        got = 0; // nothing there after all
+    } else if (got == 0) {
+        c.readDone = true; // the replies are still sent, see closeFinished()
+    }
+    c.in.resize(old + got);
+
+    size_t used = 0;
+    while (c.in.size() - used >= sizeof(TSPServerRequest)) {
+        TSPServerRequest head;
+        memcpy(&head, &c.in[used], sizeof(head));
+        size_t expected = sizeof(head) - sizeof(head.size) + (size_t)head.n * 2 * sizeof(double);
+        if (head.n > SERVER_MAX_N || head.size != expected) {
+            cout << "Bad request on connection " << connection << ", closing it." << endl;
+            return false;
+        }
+        if (c.in.size() - used < sizeof(head.size) + head.size) break; // not complete yet
+
+        Request r;
+        r.connection = connection;
+        r.head = head;
+        r.received = chrono::steady_clock::now();
+        const char * p = &c.in[used + sizeof(head)];
+        r.points.resize(head.n);
+        for (size_t i=0; i<head.n; i++) {
+            double xy[2];
+            memcpy(xy, p + i * sizeof(xy), sizeof(xy));
+            r.points.set(i, xy[0], xy[1]);
+        }
+        used += sizeof(head.size) + head.size;
+        if (head.kind == SERVER_SHUTDOWN) {
+            cout << "Shutting down after " << queue.size() << " queued requests." << endl;
+            stopping = true;
+        } else if (head.kind != SERVER_SOLVE || head.n == 0 || head.metric > METRIC_GEO) {
+            reply(r, SERVER_BAD_REQUEST, NULL, 0, 0);
+        } else {
+            queue.push_back(std::move(r));
+        }
+    }
+    c.in.erase(c.in.begin(), c.in.begin() + used);
+    if (c.readDone) c.in.clear();
+    return true;
+}
+
+/**
+ * sends as much of the output buffer as the socket takes.
+ * @return false if the client has gone
+ */
+bool TSPServer::flush(int connection) {
+    Connection & c = connections[connection];
+    while (c.outStart < c.out.size()) {
+        ssize_t written = send(c.fd, &c.out[c.outStart], c.out.size() - c.outStart, MSG_NOSIGNAL);
+        if (written < 0 && (errno == EAGAIN || errno == EWOULDBLOCK)) return true; // the rest on POLLOUT
+        if (written < 0 && errno == EINTR) continue;
+        if (written <= 0) return false;
+        c.outStart += written;
+    }
+    c.out.clear(); // keeps the capacity
+    c.outStart = 0;
+    return true;
+}
+
+bool TSPServer::hasPendingOutput(void) {
+    for (map<int, Connection>::iterator it = connections.begin(); it != connections.end(); ++it) {
+        if (it->second.outStart < it->second.out.size()) return true;
+    }
+    return false;
+}
+
+int TSPServer::run(void) {
+    if (!listen()) return 1;
+    cout << "Serving on " << path << " (stop with --client stop)." << endl;
+
+    while (!stopping || !queue.empty() || hasPendingOutput()) {
+        // wait for requests (or for sockets which take more output), unless there are some to solve already:
+        vector<struct pollfd> fds;
+        vector<int> numbers;
+        struct pollfd l = { listenFD, POLLIN, 0 };
+        fds.push_back(l);
+        for (map<int, Connection>::iterator it = connections.begin(); it != connections.end(); ++it) {
+            size_t pending = it->second.out.size() - it->second.outStart;
+            short events = (pending < SERVER_OUT_MAX && !it->second.readDone) ? POLLIN : 0;
+            if (pending > 0) events |= POLLOUT;
+            struct pollfd f = { it->second.fd, events, 0 };
+            fds.push_back(f);
+            numbers.push_back(it->first);
+        }
+        int timeout = (queue.empty() && !stopping) ? -1 : 0;
+        if (poll(&fds[0], fds.size(), timeout) < 0 && errno != EINTR) {
+            cout << "poll() failed: " << strerror(errno) << endl;
+            return 1;
+        }
+        if (fds[0].revents & POLLIN) accept();
+        for (size_t k=1; k<fds.size(); k++) {
+            short events = fds[k].revents;
+            if (events == 0) continue;
+            bool ok = true;
+            if (events & POLLIN) ok = receive(numbers[k-1]); // even if the client has gone: e.g. --client stop
+            if (events & (POLLHUP | POLLERR | POLLNVAL)) ok = false; // gone completely (a half-close is only the end of the stream)
+            if (ok && (events & POLLOUT)) ok = flush(numbers[k-1]);
+            if (!ok) close(numbers[k-1]);
+        }
+        process();
+        closeFinished();
+    }
+    cout << debug();
+    return 0;
+}
+
+/**
+ * all queued small instances (up to SERVER_BATCH_MAX) as one batch, then at
+ * most one large instance.
+ */
+void TSPServer::process(void) {
+    vector<Request> batch;
+    for (deque<Request>::iterator it = queue.begin(); it != queue.end() && batch.size() < SERVER_BATCH_MAX; ) {
+        if (it->head.n <= SMALL_MAX_N) {
+            batch.push_back(std::move(*it));
+            it = queue.erase(it);
+        } else {
+            ++it;
+        }
+    }
+    if (!batch.empty()) solveBatch(batch);
+
+    if (!queue.empty() && queue.front().head.n > SMALL_MAX_N) {
+        Request r = std::move(queue.front());
+        queue.pop_front();
+        solveLarge(r);
+    }
+}
+
+void TSPServer::solveBatch(vector<Request> & batch) {
+    TSP_ZONE("serverBatch");
+    vector< vector<int> > routes(batch.size());
+    vector<double> lengths(batch.size(), 0);
+    threadPool->parallelFor(batch.size(), [&](size_t k) {
+        const Request & r = batch[k];
+        routes[k].resize(r.head.n);
+        solveSmall(r.points, NULL, r.head.n, &routes[k][0], (TSPMetric)r.head.metric);
+        lengths[k] = metricTourLength((TSPMetric)r.head.metric, r.points, &routes[k][0], r.head.n);
+    });
+    for (size_t k=0; k<batch.size(); k++) reply(batch[k], SERVER_OK, &routes[k][0], routes[k].size(), lengths[k]);
+    batches ++;
+}
+
+void TSPServer::solveLarge(Request & r) {
+    TSP_ZONE("serverLarge");
+    if (r.head.metric != METRIC_EUCLIDEAN) {
+        reply(r, SERVER_UNSUPPORTED, NULL, 0, 0);
+        return;
+    }
+    CacheEntry * e = prepare(r.points);
+
+    TSPRoute * start = NULL;
+    if (!e->best.empty()) {
+        start = routePool->acquire();
+        for (size_t i=0; i<e->best.size(); i++) start->addStep(e->best[i]);
+    }
+    TSPAnytimeSolver solver(&optimizer, threadPool, r.head.id);
+    solver.setConstruction(CONSTRUCT_PARTITION); // naiveClosest() is quadratic, too slow for the deadlines of large instances
+    if (r.head.targetGap > 0 && r.head.n <= BOUND_AUTO_MAX_N) {
+        if (e->bound < 0) {
+            // once per instance; the best route so far (or a quick one) is the upper bound:
+            TSPRoute * upper = (start != NULL) ? start : TSPRouter::naiveClosest();
+            TSPLowerBound lb(points, distances, NULL); // dense, i.e. a valid bound
+            e->bound = lb.compute(upper->getLength());
+            if (upper != start) routePool->release(upper);
+        }
+        if (e->bound > 0) solver.setTarget(e->bound * (1 + r.head.targetGap));
+    }
+    TSPRoute * best = solver.solve(start, (r.head.seconds > 0) ? r.head.seconds : -1);
+    routePool->release(start);
+
+    vector<int> order(best->getSize());
+    for (size_t i=0; i<order.size(); i++) order[i] = best->getStep(i);
+    if (e->best.empty() || best->getLength() < e->bestLength) {
+        e->best = order;
+        e->bestLength = best->getLength();
+    }
+    reply(r, SERVER_OK, &order[0], order.size(), best->getLength());
+    routePool->release(best);
+}
+
+/**
+ * makes p the global instance, with distances and candidate lists from the
+ * cache (or new ones, added to the cache).
+ */
+TSPServer::CacheEntry * TSPServer::prepare(const TSPPointStore & p) {
+    uint64_t hash = p.getHash();
+    size_t n = p.size();
+    for (size_t i=0; i<cache.size(); i++) {
+        CacheEntry * e = cache[i];
+        if (e->hash != hash || e->points.size() != n) continue;
+        if (memcmp(e->points.getXs(), p.getXs(), n * sizeof(double)) != 0) continue;
+        if (memcmp(e->points.getYs(), p.getYs(), n * sizeof(double)) != 0) continue;
+        e->lastUse = ++useCounter;
+        points = e->points;
+        distances = e->distances;
+        candidates = e->candidates;
+        cacheHits ++;
+        return e;
+    }
+
+    // new: preprocess like init()
+    cacheMisses ++;
+    points = p;
+    CacheEntry * e = new CacheEntry();
+    e->points = p;
+    e->hash = hash;
+    e->candidates = new TSPCandidateLists(points, CANDIDATES_K);
+    if (n <= MATRIX_MAX_N) {
+        e->distances = new TSPRoutingTable(points);
+        e->bytes = n * (n - 1) / 2 * sizeof(double);
+    } else {
+        TSPOnTheFlyDistances * onTheFly = new TSPOnTheFlyDistances(points, n * CANDIDATES_K);
+        onTheFly->prewarm(*e->candidates);
+        e->distances = onTheFly;
+        e->bytes = n * CANDIDATES_K * 2 * sizeof(double);
+    }
+    e->bytes += n * (CANDIDATES_K * sizeof(int) + 2 * sizeof(double));
+    e->bestLength = 0;
+    e->bound = -1;
+    e->lastUse = ++useCounter;
+    distances = e->distances;
+    candidates = e->candidates;
+
+    // make room (but keep e):
+    cacheBytes += e->bytes;
+    while (cacheBytes > SERVER_CACHE_BYTES && !cache.empty()) {
+        size_t oldest = 0;
+        for (size_t i=1; i<cache.size(); i++) if (cache[i]->lastUse < cache[oldest]->lastUse) oldest = i;
+        CacheEntry * old = cache[oldest];
+        cacheBytes -= old->bytes;
+        delete old->distances;
+        delete old->candidates;
+        delete old;
+        cache.erase(cache.begin() + oldest);
+    }
+    cache.push_back(e);
+    return e;
+}
+
+void TSPServer::reply(const Request & r, uint32_t status, const int * order, size_t n, double length) {
+    solved ++;
+    TSPServerReply head;
+    head.size = sizeof(head) - sizeof(head.size) + n * sizeof(int32_t);
+    head.id = r.head.id;
+    head.status = status;
+    head.n = n;
+    head.length = length;
+    head.seconds = chrono::duration<double>(chrono::steady_clock::now() - r.received).count();
+
+    if (connections.find(r.connection) == connections.end()) return; // the client has gone
+    Connection & c = connections[r.connection];
+    size_t start = c.out.size();
+    c.out.resize(start + sizeof(head) + n * sizeof(int32_t));
+    memcpy(&c.out[start], &head, sizeof(head));
+    for (size_t i=0; i<n; i++) {
+        int32_t step = order[i];
+        memcpy(&c.out[start + sizeof(head) + i * sizeof(step)], &step, sizeof(step));
+    }
+    if (!flush(r.connection)) ::shutdown(c.fd, SHUT_RDWR); // poll() notices, then it is closed
+}
+
+string TSPServer::debug(void) {
+    stringstream ss;
+    ss << "TSPServer: " << solved << " requests, " << batches << " small batches, ";
+    ss << "cache " << cacheHits << " hits / " << cacheMisses << " misses, ";
+    ss << cache.size() << " instances (" << TSPMemoryStats::formatBytes(cacheBytes) << ")" << endl;
+    return ss.str();
+}
+
+/**
+ * the other side, e.g. to test the server: sends requests (from a second
+ * thread, so that sending and receiving overlap) and reads the replies.
+ */
+class TSPServerClient {
+    protected:
+        int fd;
+    public:
+        TSPServerClient() { fd = -1; }
+        ~TSPServerClient() { if (fd >= 0) ::close(fd); }
+        bool connect(string path);
+        bool send(uint32_t id, const TSPPointStore & p, double seconds, TSPMetric metric = METRIC_EUCLIDEAN, double targetGap = 0);
+        bool shutdown(void);
+        bool receive(TSPServerReply & head, vector<int> & route);
+};
+
+bool TSPServerClient::connect(string path) {
+    struct sockaddr_un address;
+    memset(&address, 0, sizeof(address));
+    address.sun_family = AF_UNIX;
+    if (path.size() >= sizeof(address.sun_path)) return false;
+    strcpy(address.sun_path, path.c_str());
+    fd = socket(AF_UNIX, SOCK_STREAM, 0);
+    if (fd < 0 || ::connect(fd, (struct sockaddr *)&address, sizeof(address)) != 0) {
+        cout << "Could not connect to " << path << ": " << strerror(errno) << endl;
+        return false;
+    }
+    return true;
+}
+
+bool TSPServerClient::send(uint32_t id, const TSPPointStore & p, double seconds, TSPMetric metric, double targetGap) {
+    TSPServerRequest head;
+    memset(&head, 0, sizeof(head));
+    head.n = p.size();
+    head.size = sizeof(head) - sizeof(head.size) + (size_t)head.n * 2 * sizeof(double);
+    head.kind = SERVER_SOLVE;
+    head.id = id;
+    head.metric = metric;
+    head.seconds = seconds;
+    head.targetGap = targetGap;
+    vector<char> out(sizeof(head) + (size_t)head.n * 2 * sizeof(double));
+    memcpy(&out[0], &head, sizeof(head));
+    for (size_t i=0; i<p.size(); i++) {
+        double xy[2] = { p.getX(i), p.getY(i) };
+        memcpy(&out[sizeof(head) + i * sizeof(xy)], xy, sizeof(xy));
+    }
+    return serverWriteAll(fd, &out[0], out.size());
+}
+
+bool TSPServerClient::shutdown(void) {
+    TSPServerRequest head;
+    memset(&head, 0, sizeof(head));
+    head.size = sizeof(head) - sizeof(head.size);
+    head.kind = SERVER_SHUTDOWN;
+    return serverWriteAll(fd, &head, sizeof(head));
+}
+
+bool TSPServerClient::receive(TSPServerReply & head, vector<int> & route) {
+    if (!serverReadAll(fd, &head, sizeof(head))) return false;
+    vector<int32_t> steps(head.n);
+    if (head.n > 0 && !serverReadAll(fd, &steps[0], head.n * sizeof(int32_t))) return false;
+    route.assign(steps.begin(), steps.end());
+    return true;
+}
+
+#endif
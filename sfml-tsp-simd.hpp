@@ -0,0 +1,300 @@
+#ifndef TSP_SIMD
+#define TSP_SIMD 1
+
+#include <cstdlib> // for posix_memalign() and free()
+#include <new> // for bad_alloc
+
+// pick the widest available instruction set (define TSP_SIMD_DISABLE to force the scalar code):
+#if !defined(TSP_SIMD_DISABLE) && defined(__AVX2__)
+    #include <immintrin.h>
+    #define TSP_SIMD_AVX2 1
+#elif !defined(TSP_SIMD_DISABLE) && defined(__SSE2__)
+    #include <emmintrin.h>
+    #define TSP_SIMD_SSE2 1
+#endif
+
+using namespace std;
+
+
+/////////////////////////////////////////////////////////////////////////////
+//                                                                         //
+// ALIGNED STORAGE:                                                        //
+//                                                                         //
+/////////////////////////////////////////////////////////////////////////////
+
+/**
+ * minimal STL allocator which returns memory aligned to the given boundary
+ * (32 bytes = one AVX register).
+ */
+template <class T, size_t Alignment = 32, int Category = MEM_POINTS>
+class AlignedAllocator {
+    public:
+        typedef T value_type;
+        template <class U> struct rebind { typedef AlignedAllocator<U, Alignment, Category> other; };
+
+        AlignedAllocator() { }
+        template <class U> AlignedAllocator(const AlignedAllocator<U, Alignment, Category> &) { }
+
+        T * allocate(size_t n) {
+            void * p = NULL;
+            if (posix_memalign(&p, Alignment, n * sizeof(T)) != 0) throw bad_alloc();
+            memoryAllocated(Category, n * sizeof(T)); // see sfml-tsp-memory.hpp
+            return (T *)p;
+        }
+        void deallocate(T * p, size_t n) { memoryFreed(Category, n * sizeof(T)); free(p); }
+};
+
+template <class T, class U, size_t A, int C>
+bool operator==(const AlignedAllocator<T, A, C> &, const AlignedAllocator<U, A, C> &) { return true; }
+template <class T, class U, size_t A, int C>
+bool operator!=(const AlignedAllocator<T, A, C> &, const AlignedAllocator<U, A, C> &) { return false; }
+
+
+/////////////////////////////////////////////////////////////////////////////
+//                                                                         //
+// DISTANCE KERNELS:                                                       //
+//                                                                         //
+/////////////////////////////////////////////////////////////////////////////
+
+/**
+ * one-to-many distances: out[k] = distance from (px;py) to (xs[k];ys[k]) for k=0..n-1
+ * (this also fills one row of the routing table)
+ */
+void simdDistanceRow(const double * xs, const double * ys, size_t n, double px, double py, double * out) {
+    size_t k = 0;
+#if defined(TSP_SIMD_AVX2)
+    __m256d vpx = _mm256_set1_pd(px);
+    __m256d vpy = _mm256_set1_pd(py);
+    for (; k + 4 <= n; k += 4) {
+        __m256d dx = _mm256_sub_pd(_mm256_loadu_pd(xs + k), vpx);
+        __m256d dy = _mm256_sub_pd(_mm256_loadu_pd(ys + k), vpy);
+        __m256d d2 = _mm256_add_pd(_mm256_mul_pd(dx, dx), _mm256_mul_pd(dy, dy));
+        _mm256_storeu_pd(out + k, _mm256_sqrt_pd(d2));
+    }
+#elif defined(TSP_SIMD_SSE2)
+    __m128d vpx = _mm_set1_pd(px);
+    __m128d vpy = _mm_set1_pd(py);
+    for (; k + 2 <= n; k += 2) {
+        __m128d dx = _mm_sub_pd(_mm_loadu_pd(xs + k), vpx);
+        __m128d dy = _mm_sub_pd(_mm_loadu_pd(ys + k), vpy);
+        __m128d d2 = _mm_add_pd(_mm_mul_pd(dx, dx), _mm_mul_pd(dy, dy));
+        _mm_storeu_pd(out + k, _mm_sqrt_pd(d2));
+    }
+#endif
+    // scalar remainder (or everything, without SIMD support):
+    for (; k < n; k++) {
+        double dx = xs[k] - px;
+        double dy = ys[k] - py;
+        out[k] = sqrt(dx*dx + dy*dy);
+    }
+}
+
+/**
+ * @return the index k (0..n-1) of the point closest to (px;py), or -1 if n==0;
+ *         on ties, the lowest index wins.
+ */
+int simdNearest(const double * xs, const double * ys, size_t n, double px, double py) {
+    if (n == 0) return -1;
+
+    double bestD2 = 1e300;
+    size_t bestIdx = 0;
+    size_t k = 0;
+#if defined(TSP_SIMD_AVX2)
+    if (n >= 4) {
+        __m256d vpx = _mm256_set1_pd(px);
+        __m256d vpy = _mm256_set1_pd(py);
+        __m256d best = _mm256_set1_pd(1e300);
+        __m256d bestI = _mm256_set1_pd(0);
+        __m256d idx = _mm256_set_pd(3, 2, 1, 0);
+        __m256d four = _mm256_set1_pd(4);
+        for (; k + 4 <= n; k += 4) {
+            __m256d dx = _mm256_sub_pd(_mm256_loadu_pd(xs + k), vpx);
+            __m256d dy = _mm256_sub_pd(_mm256_loadu_pd(ys + k), vpy);
+            __m256d d2 = _mm256_add_pd(_mm256_mul_pd(dx, dx), _mm256_mul_pd(dy, dy));
+            __m256d closer = _mm256_cmp_pd(d2, best, _CMP_LT_OQ);
+            best = _mm256_blendv_pd(best, d2, closer);
+            bestI = _mm256_blendv_pd(bestI, idx, closer);
+            idx = _mm256_add_pd(idx, four);
+        }
+        double laneD2[4], laneI[4];
+        _mm256_storeu_pd(laneD2, best);
+        _mm256_storeu_pd(laneI, bestI);
+        for (int l=0; l<4; l++) {
+            if (laneD2[l] < bestD2 || (laneD2[l] == bestD2 && laneI[l] < bestIdx)) {
+                bestD2 = laneD2[l];
+                bestIdx = (size_t)laneI[l];
+            }
+        }
+    }
+#elif defined(TSP_SIMD_SSE2)
+    if (n >= 2) {
+        __m128d vpx = _mm_set1_pd(px);
+        __m128d vpy = _mm_set1_pd(py);
+        __m128d best = _mm_set1_pd(1e300);
+        __m128d bestI = _mm_set1_pd(0);
+        __m128d idx = _mm_set_pd(1, 0);
+        __m128d two = _mm_set1_pd(2);
+        for (; k + 2 <= n; k += 2) {
+            __m128d dx = _mm_sub_pd(_mm_loadu_pd(xs + k), vpx);
+            __m128d dy = _mm_sub_pd(_mm_loadu_pd(ys + k), vpy);
+            __m128d d2 = _mm_add_pd(_mm_mul_pd(dx, dx), _mm_mul_pd(dy, dy));
+            __m128d closer = _mm_cmplt_pd(d2, best);
+            best = _mm_or_pd(_mm_and_pd(closer, d2), _mm_andnot_pd(closer, best));
+            bestI = _mm_or_pd(_mm_and_pd(closer, idx), _mm_andnot_pd(closer, bestI));
+            idx = _mm_add_pd(idx, two);
+        }
+        double laneD2[2], laneI[2];
+        _mm_storeu_pd(laneD2, best);
+        _mm_storeu_pd(laneI, bestI);
+        for (int l=0; l<2; l++) {
+            if (laneD2[l] < bestD2 || (laneD2[l] == bestD2 && laneI[l] < bestIdx)) {
+                bestD2 = laneD2[l];
+                bestIdx = (size_t)laneI[l];
+            }
+        }
+    }
+#endif
+    for (; k < n; k++) {
+        double dx = xs[k] - px;
+        double dy = ys[k] - py;
+        double d2 = dx*dx + dy*dy;
+        if (d2 < bestD2) {
+            bestD2 = d2;
+            bestIdx = k;
+        }
+    }
+    return bestIdx;
+}
+
+#if defined(TSP_SIMD_AVX2)
+// loads base[idx[0..3]] (the masked variant avoids an uninitialized source register):
+inline __m256d simdGather4(const double * base, __m128i idx) {
+    __m256d all = _mm256_castsi256_pd(_mm256_set1_epi64x(-1));
+    return _mm256_mask_i32gather_pd(_mm256_setzero_pd(), base, idx, all, 8);
+}
+#endif
+
+/**
+ * @return the length of the closed tour seq[0] -> seq[1] -> ... -> seq[n-1] -> seq[0]
+ */
+double simdTourLength(const double * xs, const double * ys, const int * seq, size_t n) {
+    if (n < 2) return 0;
+
+    double total = 0;
+    size_t k = 0;
+#if defined(TSP_SIMD_AVX2)
+    __m256d acc = _mm256_setzero_pd();
+    for (; k + 5 <= n; k += 4) { // needs seq[k+4] as the last "to" point
+        __m128i from = _mm_loadu_si128((const __m128i *)(seq + k));
+        __m128i to = _mm_loadu_si128((const __m128i *)(seq + k + 1));
+        __m256d dx = _mm256_sub_pd(simdGather4(xs, to), simdGather4(xs, from));
+        __m256d dy = _mm256_sub_pd(simdGather4(ys, to), simdGather4(ys, from));
+        __m256d d2 = _mm256_add_pd(_mm256_mul_pd(dx, dx), _mm256_mul_pd(dy, dy));
+        acc = _mm256_add_pd(acc, _mm256_sqrt_pd(d2));
+    }
+    double lanes[4];
+    _mm256_storeu_pd(lanes, acc);
+    total = (lanes[0] + lanes[1]) + (lanes[2] + lanes[3]);
+#elif defined(TSP_SIMD_SSE2)
+    __m128d acc = _mm_setzero_pd();
+    for (; k + 3 <= n; k += 2) { // needs seq[k+2] as the last "to" point
+        __m128d fx = _mm_set_pd(xs[seq[k+1]], xs[seq[k]]);
+        __m128d fy = _mm_set_pd(ys[seq[k+1]], ys[seq[k]]);
+        __m128d tx = _mm_set_pd(xs[seq[k+2]], xs[seq[k+1]]);
+        __m128d ty = _mm_set_pd(ys[seq[k+2]], ys[seq[k+1]]);
+        __m128d dx = _mm_sub_pd(tx, fx);
+        __m128d dy = _mm_sub_pd(ty, fy);
+        acc = _mm_add_pd(acc, _mm_sqrt_pd(_mm_add_pd(_mm_mul_pd(dx, dx), _mm_mul_pd(dy, dy))));
+    }
+    double lanes[2];
+    _mm_storeu_pd(lanes, acc);
+    total = lanes[0] + lanes[1];
+#endif
+    for (; k < n; k++) {
+        int from = seq[k];
+        int to = (k + 1 < n) ? seq[k+1] : seq[0]; // either the next point, or back to the first one.
+        double dx = xs[to] - xs[from];
+        double dy = ys[to] - ys[from];
+        total += sqrt(dx*dx + dy*dy);
+    }
+    return total;
+}
+
+
+
+/////////////////////////////////////////////////////////////////////////////
+//                                                                         //
+// SEGMENT KERNELS:                                                        //
+//                                                                         //
+/////////////////////////////////////////////////////////////////////////////
+
+#define SEGMENTS_APART 0
+#define SEGMENTS_CROSS 1
+#define SEGMENTS_UNSURE 2 // too close to call in double precision, use the exact predicate
+
+// relative error bound of the floating point orientation determinant (Shewchuk's ccwerrboundA):
+static const double ORIENT_ERRBOUND = (3.0 + 16.0 * 1.1102230246251565e-16) * 1.1102230246251565e-16;
+
+/**
+ * one-vs-many segment test: out[k] tells if AB properly crosses the segment
+ * (cx[k];cy[k]) - (dx[k];dy[k]), for k=0..n-1. No divisions: only the signs of
+ * four orientation determinants, each checked against its error bound;
+ * uncertain cases (nearly collinear points) are marked SEGMENTS_UNSURE.
+ */
+void simdSegmentsCross(double ax, double ay, double bx, double by,
+        const double * cx, const double * cy, const double * dx, const double * dy,
+        size_t n, unsigned char * out) {
+    size_t k = 0;
+#if defined(TSP_SIMD_AVX2)
+    const __m256d vax = _mm256_set1_pd(ax), vay = _mm256_set1_pd(ay);
+    const __m256d vbx = _mm256_set1_pd(bx), vby = _mm256_set1_pd(by);
+    const __m256d eps = _mm256_set1_pd(ORIENT_ERRBOUND);
+    const __m256d absMask = _mm256_castsi256_pd(_mm256_set1_epi64x(0x7FFFFFFFFFFFFFFFLL));
+
+    // orientation of r relative to pq, and whether its sign is certain:
+    auto orient = [&](__m256d px, __m256d py, __m256d qx, __m256d qy, __m256d rx, __m256d ry, __m256d & certain) {
+        __m256d prx = _mm256_sub_pd(px, rx), pry = _mm256_sub_pd(py, ry);
+        __m256d qrx = _mm256_sub_pd(qx, rx), qry = _mm256_sub_pd(qy, ry);
+        __m256d l = _mm256_mul_pd(prx, qry);
+        __m256d r = _mm256_mul_pd(pry, qrx);
+        __m256d det = _mm256_sub_pd(l, r);
+        __m256d bound = _mm256_mul_pd(eps, _mm256_add_pd(_mm256_and_pd(l, absMask), _mm256_and_pd(r, absMask)));
+        certain = _mm256_and_pd(certain, _mm256_cmp_pd(_mm256_and_pd(det, absMask), bound, _CMP_GT_OQ));
+        return det;
+    };
+
+    for (; k + 4 <= n; k += 4) {
+        __m256d vcx = _mm256_loadu_pd(cx + k), vcy = _mm256_loadu_pd(cy + k);
+        __m256d vdx = _mm256_loadu_pd(dx + k), vdy = _mm256_loadu_pd(dy + k);
+        __m256d certain = _mm256_castsi256_pd(_mm256_set1_epi64x(-1));
+        __m256d o1 = orient(vax, vay, vbx, vby, vcx, vcy, certain);
+        __m256d o2 = orient(vax, vay, vbx, vby, vdx, vdy, certain);
+        __m256d o3 = orient(vcx, vcy, vdx, vdy, vax, vay, certain);
+        __m256d o4 = orient(vcx, vcy, vdx, vdy, vbx, vby, certain);
+        // opposite signs <=> the sign bit of (o1 xor o2) is set:
+        int cross = _mm256_movemask_pd(_mm256_and_pd(_mm256_xor_pd(o1, o2), _mm256_xor_pd(o3, o4)));
+        int sure = _mm256_movemask_pd(certain);
+        for (int l=0; l<4; l++) {
+            if (!(sure & (1 << l))) out[k + l] = SEGMENTS_UNSURE;
+            else out[k + l] = (cross & (1 << l)) ? SEGMENTS_CROSS : SEGMENTS_APART;
+        }
+    }
+#endif
+    for (; k < n; k++) {
+        double det[4];
+        bool sure = true;
+        const double px[4] = { ax, ax, cx[k], cx[k] }, py[4] = { ay, ay, cy[k], cy[k] };
+        const double qx[4] = { bx, bx, dx[k], dx[k] }, qy[4] = { by, by, dy[k], dy[k] };
+        const double rx[4] = { cx[k], dx[k], ax, bx }, ry[4] = { cy[k], dy[k], ay, by };
+        for (int o=0; o<4; o++) {
+            double l = (px[o] - rx[o]) * (qy[o] - ry[o]);
+            double r = (py[o] - ry[o]) * (qx[o] - rx[o]);
+            det[o] = l - r;
+            if (!(fabs(det[o]) > ORIENT_ERRBOUND * (fabs(l) + fabs(r)))) sure = false;
+        }
+        if (!sure) out[k] = SEGMENTS_UNSURE;
+        else out[k] = ((det[0] > 0) != (det[1] > 0) && (det[2] > 0) != (det[3] > 0)) ? SEGMENTS_CROSS : SEGMENTS_APART;
+    }
+}
+
+#endif
@@ -0,0 +1,230 @@
+#ifndef TSP_SMALL
+#define TSP_SMALL 1
+
+#include <bitset>
+
+#define SMALL_MAX_N 48 // up to this many points, solveSmall() uses the fixed-size solvers (above, TSPLocalSearch is as fast)
+
+using namespace std;
+
+
+/////////////////////////////////////////////////////////////////////////////
+//                                                                         //
+// CLASSES AND METHODS:                                                    //
+//                                                                         //
+/////////////////////////////////////////////////////////////////////////////
+
+/**
+ * all distances between up to N points in the metric of the policy, in a
+ * plain array (no vector, no indirection through TSPDistanceProvider).
+ */
+template <int N, class Metric>
+class FixedRoutingTable {
+    public:
+        typedef typename Metric::Value Value;
+        Value d[N][N];
+        int n;
+        void load(const TSPPointStore & points, const int * ids, int n) {
+            this->n = n;
+            for (int i=0; i<n; i++) {
+                d[i][i] = 0;
+                double x = points.getX(ids[i]), y = points.getY(ids[i]);
+                for (int j=0; j<i; j++) d[i][j] = d[j][i] = Metric::distance(x, y, points.getX(ids[j]), points.getY(ids[j]));
+            }
+        }
+        Value operator()(int a, int b) const { return d[a][b]; }
+};
+
+/**
+ * a route over the local points 0..n-1 (n <= N). seq[n] repeats seq[0],
+ * so that seq[i+1] never needs a modulo.
+ */
+template <int N>
+class FixedRoute {
+    public:
+        int seq[N + 1];
+        int n;
+        void close(void) { seq[n] = seq[0]; }
+        template <class Metric>
+        typename Metric::Sum getLength(const FixedRoutingTable<N, Metric> & d) const {
+            typename Metric::Sum l0 = 0, l1 = 0, l2 = 0, l3 = 0; // four independent sums
+            int i = 0;
+            for (; i + 4 <= n; i += 4) {
+                l0 += d(seq[i], seq[i+1]);
+                l1 += d(seq[i+1], seq[i+2]);
+                l2 += d(seq[i+2], seq[i+3]);
+                l3 += d(seq[i+3], seq[i+4]);
+            }
+            for (; i<n; i++) l0 += d(seq[i], seq[i+1]);
+            return (l0 + l1) + (l2 + l3);
+        }
+        /** reverses seq[i..j], i <= j < n */
+        void reverse(int i, int j) {
+            for (; i < j; i++, j--) { int t = seq[i]; seq[i] = seq[j]; seq[j] = t; }
+            close();
+        }
+};
+
+/**
+ * nearest neighbour, then 2-opt and Or-opt (segments of 1..3 points, also
+ * reversed) on the complete neighbourhood until no move improves. For many
+ * small instances this is several times faster than TSPLocalSearch or
+ * TSPRouteOptimizer; everything lives on the stack. With an integer metric,
+ * all move deltas are exact int arithmetic.
+ */
+template <int N, class Metric>
+class TSPSmallSolver {
+    protected:
+        typedef typename Metric::Value Value;
+        FixedRoutingTable<N, Metric> d;
+        FixedRoute<N> r;
+        void nearestNeighbour(void);
+        bool twoOpt(void);
+        bool orOpt(void);
+    public:
+        typename Metric::Sum solve(const TSPPointStore & points, const int * ids, int n, int * out);
+};
+
+template <int N, class Metric>
+void TSPSmallSolver<N, Metric>::nearestNeighbour(void) {
+    int n = d.n;
+    bitset<N> visited;
+    r.n = n;
+    r.seq[0] = 0;
+    visited.set(0);
+    for (int k=1; k<n; k++) {
+        int from = r.seq[k-1], best = -1;
+        for (int i=1; i<n; i++) {
+            if (visited.test(i)) continue;
+            if (best < 0 || d(from, i) < d(from, best)) best = i;
+        }
+        r.seq[k] = best;
+        visited.set(best);
+    }
+    r.close();
+}
+
+/**
+ * first improvement: replaces the edges (i, i+1) and (j, j+1) by (i, j) and (i+1, j+1).
+ */
+template <int N, class Metric>
+bool TSPSmallSolver<N, Metric>::twoOpt(void) {
+    int n = r.n;
+    bool improved = false;
+    for (int i=0; i<n-2; i++) {
+        int a = r.seq[i], b = r.seq[i+1];
+        Value ab = d(a, b);
+        for (int j=i+2; j<n; j++) {
+            if (i == 0 && j == n-1) continue; // the same two edges
+            int c = r.seq[j], e = r.seq[j+1];
+            Value delta = d(a, c) + d(b, e) - ab - d(c, e);
+            if (Metric::improves(delta)) {
+                r.reverse(i+1, j);
+                improved = true;
+                b = r.seq[i+1];
+                ab = d(a, b);
+            }
+        }
+    }
+    return improved;
+}
+
+/**
+ * first improvement: moves seq[i..i+len-1] between two other neighbours (in
+ * either direction). seq[0] stays in front, so the segments never wrap.
+ */
+template <int N, class Metric>
+bool TSPSmallSolver<N, Metric>::orOpt(void) {
+    int n = r.n;
+    bool improved = false;
+    for (int len=1; len<=3; len++) {
+        for (int i=1; i+len<=n; i++) {
+            int prev = r.seq[i-1], s0 = r.seq[i], s1 = r.seq[i+len-1], next = r.seq[i+len];
+            Value removeGain = d(prev, s0) + d(s1, next) - d(prev, next);
+            if (!Metric::improves(-removeGain)) continue;
+            int bestP = -1;
+            bool bestReversed = false;
+            Value bestDelta = 0;
+            for (int p=0; p<n; p++) {
+                if (p >= i-1 && p <= i+len-1) continue; // edges next to or inside the segment
+                int u = r.seq[p], v = r.seq[p+1];
+                Value duv = d(u, v);
+                Value forward = d(u, s0) + d(s1, v) - duv - removeGain;
+                Value backward = d(u, s1) + d(s0, v) - duv - removeGain;
+                if (Metric::improves(forward) && (bestP < 0 || forward < bestDelta)) { bestDelta = forward; bestP = p; bestReversed = false; }
+                if (Metric::improves(backward) && (bestP < 0 || backward < bestDelta)) { bestDelta = backward; bestP = p; bestReversed = true; }
+            }
+            if (bestP < 0) continue;
+
+            // rebuild: the route without the segment, the segment after seq[bestP]:
+            int segment[3];
+            for (int k=0; k<len; k++) segment[k] = r.seq[bestReversed ? i+len-1-k : i+k];
+            int tmp[N + 1];
+            int m = 0;
+            for (int k=0; k<n; k++) {
+                if (k >= i && k < i+len) continue;
+                tmp[m++] = r.seq[k];
+                if (k == bestP) for (int s=0; s<len; s++) tmp[m++] = segment[s];
+            }
+            for (int k=0; k<n; k++) r.seq[k] = tmp[k];
+            r.close();
+            improved = true;
+        }
+    }
+    return improved;
+}
+
+/**
+ * @param ids the point IDs to visit (n of them, n <= N)
+ * @param out receives the route as point IDs
+ * @return the length of the route
+ */
+template <int N, class Metric>
+typename Metric::Sum TSPSmallSolver<N, Metric>::solve(const TSPPointStore & points, const int * ids, int n, int * out) {
+    d.load(points, ids, n);
+    nearestNeighbour();
+    if (n >= 4) {
+        bool improved = true;
+        while (improved) {
+            improved = twoOpt();
+            improved = orOpt() || improved;
+        }
+    }
+    for (int i=0; i<n; i++) out[i] = ids[r.seq[i]];
+    return r.getLength(d);
+}
+
+/**
+ * picks the smallest fixed-size solver for n points (ids: never NULL here).
+ */
+template <class Metric>
+void solveSmallIn(const TSPPointStore & points, const int * ids, size_t n, int * out) {
+    if (n <= 16) TSPSmallSolver<16, Metric>().solve(points, ids, n, out);
+    else if (n <= 32) TSPSmallSolver<32, Metric>().solve(points, ids, n, out);
+    else TSPSmallSolver<SMALL_MAX_N, Metric>().solve(points, ids, n, out);
+}
+
+/**
+ * solves n points with the fixed-size solver for their number and the metric.
+ * @param ids the point IDs to visit (NULL: 0..n-1)
+ * @return false if n is too large (> SMALL_MAX_N), then out is unchanged
+ */
+bool solveSmall(const TSPPointStore & points, const int * ids, size_t n, int * out, TSPMetric metric = METRIC_EUCLIDEAN) {
+    if (n > SMALL_MAX_N) return false;
+    int all[SMALL_MAX_N];
+    if (ids == NULL) {
+        for (size_t i=0; i<n; i++) all[i] = i;
+        ids = all;
+    }
+    switch (metric) {
+        case METRIC_EUC_2D: solveSmallIn<MetricEuc2D>(points, ids, n, out); break;
+        case METRIC_CEIL_2D: solveSmallIn<MetricCeil2D>(points, ids, n, out); break;
+        case METRIC_MANHATTAN: solveSmallIn<MetricManhattan>(points, ids, n, out); break;
+        case METRIC_MAX_NORM: solveSmallIn<MetricMaxNorm>(points, ids, n, out); break;
+        case METRIC_GEO: solveSmallIn<MetricGeo>(points, ids, n, out); break;
+        default: solveSmallIn<MetricEuclidean>(points, ids, n, out);
+    }
+    return true;
+}
+
+#endif
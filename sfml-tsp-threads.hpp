@@ -0,0 +1,153 @@
+#ifndef TSP_THREADS
+#define TSP_THREADS 1
+
+#include <thread>
+#include <atomic>
+#include <condition_variable>
+#include <functional>
+#include <deque>
+
+#define PARALLEL_SCAN_CHUNKS 4 // chunks per thread in parallelBest(), for load balancing
+#define PARALLEL_SCAN_MIN_WORK 50000 // smaller scans (evaluated moves) stay on one thread
+
+using namespace std;
+
+
+/////////////////////////////////////////////////////////////////////////////
+//                                                                         //
+// CLASSES AND METHODS:                                                    //
+//                                                                         //
+/////////////////////////////////////////////////////////////////////////////
+
+/**
+ * a fixed set of worker threads (one per core by default), so that parallel
+ * work does not have to start new threads every time.
+ */
+class TSPThreadPool {
+    protected:
+        vector<thread> workers;
+        deque< function<void()> > tasks;
+        mutex lock;
+        condition_variable wakeUp; // new task, or stopping
+        condition_variable idle; // all tasks done
+        size_t running; // tasks being executed right now
+        bool stopping;
+        void work(void);
+    public:
+        TSPThreadPool(unsigned int threads = 0);
+        ~TSPThreadPool();
+        size_t getThreadCount(void) { return workers.size(); }
+        void submit(function<void()> task);
+        void wait(void);
+        void parallelFor(size_t count, function<void(size_t)> body);
+};
+
+/**
+ * @param threads number of workers, 0 = one per core
+ */
+TSPThreadPool::TSPThreadPool(unsigned int threads) {
+    running = 0;
+    stopping = false;
+    if (threads == 0) threads = thread::hardware_concurrency();
+    if (threads == 0) threads = 1;
+    for (unsigned int t=0; t<threads; t++) workers.push_back(thread(&TSPThreadPool::work, this));
+}
+
+TSPThreadPool::~TSPThreadPool() {
+    {
+        lock_guard<mutex> guard(lock);
+        stopping = true;
+    }
+    wakeUp.notify_all();
+    for (size_t t=0; t<workers.size(); t++) workers[t].join();
+}
+
+void TSPThreadPool::work(void) {
+    for (;;) {
+        function<void()> task;
+        {
+            unique_lock<mutex> guard(lock);
+            wakeUp.wait(guard, [this]() { return stopping || !tasks.empty(); });
+            if (tasks.empty()) return; // stopping
+            task = tasks.front();
+            tasks.pop_front();
+            running ++;
+        }
+        task();
+        {
+            lock_guard<mutex> guard(lock);
+            running --;
+            if (tasks.empty() && running == 0) idle.notify_all();
+        }
+    }
+}
+
+void TSPThreadPool::submit(function<void()> task) {
+    {
+        lock_guard<mutex> guard(lock);
+        tasks.push_back(task);
+    }
+    wakeUp.notify_one();
+}
+
+/**
+ * blocks until all submitted tasks are done. Do not call it from a task.
+ */
+void TSPThreadPool::wait(void) {
+    unique_lock<mutex> guard(lock);
+    idle.wait(guard, [this]() { return tasks.empty() && running == 0; });
+}
+
+/**
+ * runs body(0..count-1), the indices handed out one by one (dynamic load
+ * balancing), and returns when all are done.
+ */
+void TSPThreadPool::parallelFor(size_t count, function<void(size_t)> body) {
+    if (count == 0) return;
+    atomic<size_t> next(0);
+    size_t tasks = (count < workers.size()) ? count : workers.size();
+    for (size_t t=0; t<tasks; t++) {
+        submit([&]() {
+            for (size_t i = next++; i < count; i = next++) body(i);
+        });
+    }
+    wait();
+}
+
+/**
+ * the best move found by (a part of) a neighbourhood scan
+ */
+struct TSPScanBest {
+    double gain;
+    int i;
+    int j;
+};
+
+/**
+ * best-improvement scan over the indices 0..count-1: scan(from, to, best)
+ * looks at from..to-1 and updates its own best (only on a strictly larger
+ * gain). With a pool and enough work (workPerIndex = moves evaluated per
+ * index), the range is split into chunks which are scanned in parallel; the reduction goes through the chunks
+ * in order, so the result is the same as on one thread.
+ * @return the best move, gain 0 and i = -1 if nothing improves
+ */
+template <class Scan> TSPScanBest parallelBest(TSPThreadPool * pool, size_t count, size_t workPerIndex, Scan scan) {
+    TSPScanBest best = { 0, -1, -1 };
+    if (pool == NULL || pool->getThreadCount() < 2 || count * workPerIndex < PARALLEL_SCAN_MIN_WORK) {
+        scan((size_t)0, count, best);
+        return best;
+    }
+    size_t chunks = pool->getThreadCount() * PARALLEL_SCAN_CHUNKS;
+    if (chunks > count) chunks = count;
+    vector<TSPScanBest> bests(chunks, best);
+    pool->parallelFor(chunks, [&](size_t c) {
+        TSP_ZONE("scanChunk");
+        scan(count * c / chunks, count * (c + 1) / chunks, bests[c]);
+    });
+    for (size_t c=0; c<chunks; c++) {
+        if (bests[c].gain > best.gain) best = bests[c];
+    }
+    return best;
+}
+
+#endif
@@ -0,0 +1,324 @@
+#ifndef TSP_TOUR
+#define TSP_TOUR 1
+
+#include <algorithm> // for std::rotate()
+
+#define TWO_LEVEL_MIN_N 50000 // routes with at least this many points switch to TSPTwoLevelList
+
+using namespace std;
+
+
+/////////////////////////////////////////////////////////////////////////////
+//                                                                         //
+// CLASSES AND METHODS:                                                    //
+//                                                                         //
+/////////////////////////////////////////////////////////////////////////////
+
+/**
+ * tour storage for large instances (used by TSPRoute above TWO_LEVEL_MIN_N):
+ * the lower level are segments of about sqrt(n) points, each with a
+ * "reversed" bit; the upper level is the list of segments in tour order.
+ * Reversing a part of the tour only splits two segments and reverses the
+ * order (and bits) of the segments in between, i.e. costs O(sqrt(n))
+ * instead of O(n). Looking up the position of a point is O(1), accessing
+ * the point at a position is O(log(sqrt(n))).
+ */
+class TSPTwoLevelList {
+    protected:
+        typedef vector<int, TSPTrackedAllocator<int, MEM_ROUTES> > IntVector;
+        struct Segment {
+            IntVector cities;
+            bool reversed;
+            size_t first; // index (in the tour) of the first point of this segment
+        };
+        size_t n;
+        size_t segmentSize; // target size of the segments, about sqrt(n)
+        vector<Segment, TSPTrackedAllocator<Segment, MEM_ROUTES> > segs;
+        IntVector order; // segment IDs in tour order
+        IntVector segOf; // point ID -> segment ID
+        IntVector slotOf; // point ID -> index in segs[segOf].cities
+        vector<IntVector> spare; // cities of dropped segments, kept for their capacity
+
+        int addSegment(size_t first, bool reversed);
+        void dropSegments(size_t count);
+        int locate(size_t idx) const;
+        void place(int point, int segID, int slot);
+        void renumber(size_t fromRank);
+        void split(size_t idx);
+        void rebuild(void);
+        void reverseNonWrapping(size_t a, size_t b);
+        void rotate(size_t k);
+    public:
+        TSPTwoLevelList() { n = 0; segmentSize = 8; }
+        TSPTwoLevelList(const int * seq, size_t n);
+        void assign(const int * seq, size_t n);
+        void assign(const TSPTwoLevelList & other);
+        size_t size(void) const { return n; }
+        int at(size_t idx) const;
+        int indexOf(int pointID) const;
+        void set(size_t idx, int pointID);
+        void append(int pointID);
+        void reverse(size_t a, size_t b);
+        double getLength(TSPPointStore & points) const;
+        void toVector(vector<int> & out) const;
+};
+
+TSPTwoLevelList::TSPTwoLevelList(const int * seq, size_t n) {
+    this->n = 0;
+    segmentSize = 8;
+    assign(seq, n);
+}
+
+/**
+ * replaces the whole tour; the segments keep their allocated capacity.
+ */
+void TSPTwoLevelList::assign(const int * seq, size_t n) {
+    this->n = 0;
+    segmentSize = 8;
+    dropSegments(0);
+    order.clear();
+    segOf.clear();
+    slotOf.clear();
+    for (size_t i=0; i<n; i++) append(seq[i]);
+    rebuild();
+}
+
+/**
+ * copies other into this list, reusing the capacity of the segments
+ * (i.e. without allocations, once this list has been as large before).
+ */
+void TSPTwoLevelList::assign(const TSPTwoLevelList & other) {
+    if (this == &other) return;
+    n = other.n;
+    segmentSize = other.segmentSize;
+    if (segs.size() > other.segs.size()) dropSegments(other.segs.size());
+    while (segs.size() < other.segs.size()) addSegment(0, false);
+    for (size_t i=0; i<segs.size(); i++) {
+        segs[i].cities.assign(other.segs[i].cities.begin(), other.segs[i].cities.end());
+        segs[i].reversed = other.segs[i].reversed;
+        segs[i].first = other.segs[i].first;
+    }
+    order.assign(other.order.begin(), other.order.end());
+    segOf.assign(other.segOf.begin(), other.segOf.end());
+    slotOf.assign(other.slotOf.begin(), other.slotOf.end());
+}
+
+/**
+ * @return the ID of a new, empty segment (with the cities vector of a dropped one, if any)
+ */
+int TSPTwoLevelList::addSegment(size_t first, bool reversed) {
+    Segment s;
+    s.reversed = reversed;
+    s.first = first;
+    if (!spare.empty()) {
+        s.cities.swap(spare.back());
+        spare.pop_back();
+    }
+    segs.push_back(std::move(s));
+    return segs.size() - 1;
+}
+
+/**
+ * removes all segments from ID count on; their cities vectors go to spare.
+ */
+void TSPTwoLevelList::dropSegments(size_t count) {
+    for (size_t i=count; i<segs.size(); i++) {
+        segs[i].cities.clear();
+        spare.push_back(IntVector());
+        spare.back().swap(segs[i].cities);
+    }
+    if (segs.size() > count) segs.erase(segs.begin() + count, segs.end());
+}
+
+/**
+ * @return the position in order[] of the segment containing tour index idx (binary search)
+ */
+int TSPTwoLevelList::locate(size_t idx) const {
+    int lo = 0, hi = order.size() - 1;
+    while (lo < hi) {
+        int mid = (lo + hi + 1) / 2;
+        if (segs[order[mid]].first <= idx) lo = mid; else hi = mid - 1;
+    }
+    return lo;
+}
+
+void TSPTwoLevelList::place(int point, int segID, int slot) {
+    if ((size_t)point >= segOf.size()) {
+        segOf.resize(point + 1, -1);
+        slotOf.resize(point + 1, -1);
+    }
+    segOf[point] = segID;
+    slotOf[point] = slot;
+}
+
+void TSPTwoLevelList::renumber(size_t fromRank) {
+    for (size_t r=fromRank; r<order.size(); r++) {
+        if (r == 0) {
+            segs[order[r]].first = 0;
+        } else {
+            Segment & prev = segs[order[r-1]];
+            segs[order[r]].first = prev.first + prev.cities.size();
+        }
+    }
+}
+
+int TSPTwoLevelList::at(size_t idx) const {
+    const Segment & s = segs[order[locate(idx)]];
+    size_t o = idx - s.first;
+    return s.reversed ? s.cities[s.cities.size() - 1 - o] : s.cities[o];
+}
+
+int TSPTwoLevelList::indexOf(int pointID) const {
+    if (pointID < 0 || (size_t)pointID >= segOf.size() || segOf[pointID] < 0) return -1;
+    const Segment & s = segs[segOf[pointID]];
+    int slot = slotOf[pointID];
+    if (s.cities[slot] != pointID) return -1; // outdated (point has been overwritten)
+    return s.first + (s.reversed ? s.cities.size() - 1 - slot : slot);
+}
+
+void TSPTwoLevelList::set(size_t idx, int pointID) {
+    int segID = order[locate(idx)];
+    Segment & s = segs[segID];
+    size_t o = idx - s.first;
+    int slot = s.reversed ? s.cities.size() - 1 - o : o;
+    s.cities[slot] = pointID;
+    place(pointID, segID, slot);
+}
+
+void TSPTwoLevelList::append(int pointID) {
+    if (order.empty() || segs[order.back()].reversed || segs[order.back()].cities.size() >= segmentSize) {
+        order.push_back(addSegment(n, false));
+    }
+    Segment & last = segs[order.back()];
+    place(pointID, order.back(), last.cities.size());
+    last.cities.push_back(pointID);
+    n++;
+
+    // keep the segments at about sqrt(n) while growing:
+    if (segmentSize * segmentSize < n / 4) rebuild();
+}
+
+/**
+ * makes sure that a segment starts at tour index idx.
+ */
+void TSPTwoLevelList::split(size_t idx) {
+    if (idx == 0 || idx >= n) return;
+    int r = locate(idx);
+    int segID = order[r];
+    size_t o = idx - segs[segID].first;
+    if (o == 0) return; // already a boundary
+
+    int tID = addSegment(idx, segs[segID].reversed);
+    IntVector & cities = segs[segID].cities;
+    IntVector & tail = segs[tID].cities;
+    size_t len = cities.size();
+    if (!segs[tID].reversed) {
+        // tour offsets o..len-1 are the tail of the vector:
+        tail.assign(cities.begin() + o, cities.end());
+        cities.resize(o);
+    } else {
+        // tour offsets o..len-1 are the head of the (reversed) vector:
+        tail.assign(cities.begin(), cities.begin() + (len - o));
+        cities.erase(cities.begin(), cities.begin() + (len - o));
+        for (size_t i=0; i<cities.size(); i++) place(cities[i], segID, i);
+    }
+
+    for (size_t i=0; i<segs[tID].cities.size(); i++) place(segs[tID].cities[i], tID, i);
+    order.insert(order.begin() + r + 1, tID);
+}
+
+/**
+ * re-creates evenly sized, non-reversed segments (O(n), but only every O(sqrt(n)) operations).
+ */
+void TSPTwoLevelList::rebuild(void) {
+    static thread_local vector<int> seq; // reused, no allocation per call
+    toVector(seq);
+
+    segmentSize = (size_t)sqrt((double)seq.size());
+    if (segmentSize < 8) segmentSize = 8;
+
+    dropSegments(0);
+    order.clear();
+    for (size_t i=0; i<seq.size(); i++) {
+        if (i % segmentSize == 0) {
+            order.push_back(addSegment(i, false));
+        }
+        Segment & last = segs.back();
+        place(seq[i], segs.size() - 1, last.cities.size());
+        last.cities.push_back(seq[i]);
+    }
+}
+
+void TSPTwoLevelList::reverseNonWrapping(size_t a, size_t b) {
+    if (a >= b) return;
+    split(a);
+    split(b + 1);
+    int p = locate(a);
+    int q = locate(b);
+    for (int i=p, j=q; i<j; i++, j--) swap(order[i], order[j]);
+    for (int i=p; i<=q; i++) segs[order[i]].reversed = !segs[order[i]].reversed;
+    renumber(p);
+
+    // too many small segments after all the splitting?
+    if (order.size() > 4 * (n / segmentSize + 1)) rebuild();
+}
+
+/**
+ * the point at tour index k becomes the first one.
+ */
+void TSPTwoLevelList::rotate(size_t k) {
+    if (k == 0 || k >= n) return;
+    split(k);
+    int p = locate(k);
+    std::rotate(order.begin(), order.begin() + p, order.end());
+    renumber(0);
+}
+
+/**
+ * reverses the points from index a to b (inclusive, wraps around if b < a),
+ * with the same result as TSPRoute::reverseFromTo() on the plain array.
+ */
+void TSPTwoLevelList::reverse(size_t a, size_t b) {
+    if (a <= b) {
+        reverseNonWrapping(a, b);
+        return;
+    }
+    // rotate the range to the front, reverse it there, and rotate back:
+    size_t len = n - a + b + 1;
+    rotate(a);
+    reverseNonWrapping(0, len - 1);
+    rotate(n - a);
+}
+
+double TSPTwoLevelList::getLength(TSPPointStore & points) const {
+    if (n < 2) return 0;
+    double length = 0;
+    int first = at(0);
+    int prev = first;
+    for (size_t r=0; r<order.size(); r++) {
+        const Segment & s = segs[order[r]];
+        size_t len = s.cities.size();
+        for (size_t i=0; i<len; i++) {
+            int pt = s.reversed ? s.cities[len - 1 - i] : s.cities[i];
+            length += points.getDistance(prev, pt);
+            prev = pt;
+        }
+    }
+    // ... and back to the first point:
+    return length + points.getDistance(prev, first);
+}
+
+void TSPTwoLevelList::toVector(vector<int> & out) const {
+    out.clear();
+    out.reserve(n);
+    for (size_t r=0; r<order.size(); r++) {
+        const Segment & s = segs[order[r]];
+        if (s.reversed) {
+            out.insert(out.end(), s.cities.rbegin(), s.cities.rend());
+        } else {
+            out.insert(out.end(), s.cities.begin(), s.cities.end());
+        }
+    }
+}
+
+#endif
@@ -0,0 +1,316 @@
+#ifndef TSP_TRACE
+#define TSP_TRACE 1
+
+#include <stdint.h>
+#include <atomic>
+
+#define TRACE_FILE "sfml-tsp.trace"
+#define TRACE_BUFFER_SIZE (1 << 20) // bytes collected before writing to the file
+#define TRACE_VERSION 1
+
+using namespace std;
+
+
+/////////////////////////////////////////////////////////////////////////////
+//                                                                         //
+// CLASSES AND METHODS:                                                    //
+//                                                                         //
+/////////////////////////////////////////////////////////////////////////////
+
+/**
+ * file layout (native byte order): TSPTraceHeader, then one TSPTraceRecord
+ * per applied move. A MOVE_ROUTE record (j = number of points) is followed
+ * by the complete route as int32 point IDs.
+ */
+struct TSPTraceHeader {
+    char magic[8]; // "TSPTRACE"
+    uint32_t version;
+    uint32_t n;
+    uint64_t instanceHash; // TSPPointStore::getHash()
+};
+
+struct TSPTraceRecord {
+    uint64_t time; // nanoseconds since the start of the recording
+    uint32_t thread;
+    uint32_t type; // TSPMoveType
+    int32_t i;
+    int32_t j;
+    double gain; // reduction of the route length
+};
+
+static const char TRACE_MAGIC[8] = { 'T', 'S', 'P', 'T', 'R', 'A', 'C', 'E' };
+
+/**
+ * @return a small, stable number for the calling thread
+ */
+uint32_t traceThreadID(void) {
+    static atomic<uint32_t> next(0);
+    static thread_local uint32_t id = next++;
+    return id;
+}
+
+// class TSPTraceLog declared in sfml-tsp-class-declarations.hpp
+
+TSPTraceLog::TSPTraceLog(string filename) {
+    buffer.resize(TRACE_BUFFER_SIZE);
+    used = 0;
+    start = chrono::steady_clock::now();
+    file = fopen(filename.c_str(), "wb");
+    if (file == NULL) {
+        cout << "Could not open trace file: " << filename << endl;
+        return;
+    }
+
+    TSPTraceHeader h;
+    memset(&h, 0, sizeof(h));
+    memcpy(h.magic, TRACE_MAGIC, sizeof(h.magic));
+    h.version = TRACE_VERSION;
+    h.n = points.size();
+    h.instanceHash = points.getHash();
+    append(&h, sizeof(h));
+}
+
+TSPTraceLog::~TSPTraceLog() {
+    flush();
+    if (file != NULL) fclose(file);
+}
+
+/**
+ * copies raw bytes into the buffer - no formatting on the hot path.
+ */
+void TSPTraceLog::append(const void * data, size_t size) {
+    if (file == NULL) return;
+    if (used + size > buffer.size()) {
+        fwrite(&buffer[0], 1, used, file);
+        used = 0;
+    }
+    if (size > buffer.size()) {
+        fwrite(data, 1, size, file); // too big to be buffered at all
+        return;
+    }
+    memcpy(&buffer[used], data, size);
+    used += size;
+}
+
+void TSPTraceLog::appendRecord(int type, int i, int j, double gain) {
+    TSPTraceRecord rec;
+    rec.time = chrono::duration_cast<chrono::nanoseconds>(chrono::steady_clock::now() - start).count();
+    rec.thread = traceThreadID();
+    rec.type = type;
+    rec.i = i;
+    rec.j = j;
+    rec.gain = gain;
+    append(&rec, sizeof(rec));
+}
+
+void TSPTraceLog::recordMove(TSPMove m, double gain) {
+    lock_guard<mutex> guard(lock);
+    appendRecord(m.type, m.i, m.j, gain);
+}
+
+/**
+ * records a complete route, e.g. the starting point or a new random route.
+ */
+void TSPTraceLog::recordRoute(TSPRoute * r) {
+    lock_guard<mutex> guard(lock);
+    appendRecord(MOVE_ROUTE, 0, r->getSize(), 0);
+    for (size_t i=0; i<r->getSize(); i++) {
+        int32_t step = r->getStep(i);
+        append(&step, sizeof(step));
+    }
+}
+
+void TSPTraceLog::flush(void) {
+    lock_guard<mutex> guard(lock);
+    if (file == NULL) return;
+    if (used > 0) fwrite(&buffer[0], 1, used, file);
+    used = 0;
+    fflush(file);
+}
+
+static const char * traceMoveName(int type) {
+    switch (type) {
+        case MOVE_SWAP: return "swap";
+        case MOVE_SHIFT: return "shift";
+        case MOVE_UNTANGLE: return "untangle";
+        case MOVE_ROUTE: return "route";
+        case MOVE_TWO_OPT: return "2-opt";
+    }
+    return "none";
+}
+
+/**
+ * offline conversion of a binary trace into JSON lines (one object per record).
+ */
+bool TSPTraceLog::toJsonLines(string traceFile, string jsonFile) {
+    FILE * in = fopen(traceFile.c_str(), "rb");
+    if (in == NULL) { cout << "Could not open trace file: " << traceFile << endl; return false; }
+    FILE * out = fopen(jsonFile.c_str(), "w");
+    if (out == NULL) { cout << "Could not write: " << jsonFile << endl; fclose(in); return false; }
+
+    TSPTraceHeader h;
+    bool ok = (fread(&h, sizeof(h), 1, in) == 1) && memcmp(h.magic, TRACE_MAGIC, sizeof(h.magic)) == 0;
+    if (ok) {
+        fprintf(out, "{\"trace\":%u,\"n\":%u,\"instance\":\"%016llx\"}\n", h.version, h.n, (unsigned long long)h.instanceHash);
+        TSPTraceRecord rec;
+        while (ok && fread(&rec, sizeof(rec), 1, in) == 1) {
+            fprintf(out, "{\"t\":%llu,\"thread\":%u,\"op\":\"%s\",\"i\":%d,\"j\":%d,\"gain\":%.17g",
+                (unsigned long long)rec.time, rec.thread, traceMoveName(rec.type), rec.i, rec.j, rec.gain);
+            if (rec.type == MOVE_ROUTE) {
+                fprintf(out, ",\"route\":[");
+                for (int k=0; k<rec.j; k++) {
+                    int32_t step;
+                    if (fread(&step, sizeof(step), 1, in) != 1) { ok = false; break; }
+                    fprintf(out, (k > 0) ? ",%d" : "%d", step);
+                }
+                fprintf(out, "]");
+            }
+            fprintf(out, "}\n");
+        }
+    } else {
+        cout << "Not a trace file: " << traceFile << endl;
+    }
+
+    fclose(in);
+    fclose(out);
+    return ok;
+}
+
+
+/**
+ * steps through a recorded trace in the viewer, without running the solver.
+ */
+class TSPTraceReplay {
+    protected:
+        vector<TSPTraceRecord> records;
+        vector< vector<int> > routes; // for MOVE_ROUTE records, records[k].i is the index in here
+        size_t position; // number of records applied to route
+        TSPRoute route;
+        TSPSplitRoute split;
+        void applyRecord(size_t k);
+    public:
+        TSPTraceReplay() { position = 0; }
+        bool load(string filename);
+        bool stepForward(void);
+        bool stepBack(void);
+        TSPRoute * getRoute(void) { return &route; }
+        size_t getPosition(void) { return position; }
+        size_t getCount(void) { return records.size(); }
+        string describe(void);
+};
+
+/**
+ * @return whether applyRecord() can apply rec to a route of n points (the file may be damaged)
+ */
+static bool isValidTraceMove(const TSPTraceRecord & rec, int n) {
+    if (rec.i < 0 || rec.i >= n) return false;
+    switch (rec.type) {
+        case MOVE_SWAP: return true;
+        case MOVE_SHIFT: return rec.j >= 0 && rec.j < n;
+        case MOVE_UNTANGLE: return rec.j >= 0 && rec.j < n && rec.j != rec.i;
+        case MOVE_TWO_OPT: return rec.j >= 0 && rec.j < n;
+    }
+    return false;
+}
+
+bool TSPTraceReplay::load(string filename) {
+    FILE * in = fopen(filename.c_str(), "rb");
+    if (in == NULL) { cout << "Could not open trace file: " << filename << endl; return false; }
+
+    TSPTraceHeader h;
+    bool ok = (fread(&h, sizeof(h), 1, in) == 1) && memcmp(h.magic, TRACE_MAGIC, sizeof(h.magic)) == 0 && h.version == TRACE_VERSION;
+    if (!ok) {
+        cout << "Not a trace file: " << filename << endl;
+    } else if (h.instanceHash != points.getHash() || h.n != points.size()) {
+        cout << "The trace " << filename << " belongs to a different instance." << endl;
+        ok = false;
+    }
+
+    records.clear();
+    routes.clear();
+    string problem; // why the file is rejected
+    vector<char> found;
+    TSPTraceRecord rec;
+    size_t got;
+    while (ok && problem.empty() && (got = fread(&rec, 1, sizeof(rec), in)) > 0) {
+        if (got != sizeof(rec)) { problem = "a truncated record"; break; }
+        if (rec.type == MOVE_ROUTE) {
+            // always complete routes, every point exactly once:
+            if (rec.j != (int32_t)h.n) { problem = "a route of the wrong size"; break; }
+            vector<int> seq(rec.j);
+            if (rec.j > 0 && fread(&seq[0], sizeof(int32_t), rec.j, in) != (size_t)rec.j) { problem = "a truncated route"; break; }
+            found.assign(h.n, 0);
+            for (size_t k=0; k<seq.size() && problem.empty(); k++) {
+                if (seq[k] < 0 || (uint32_t)seq[k] >= h.n || found[seq[k]]) problem = "an invalid route";
+                else found[seq[k]] = 1;
+            }
+            rec.i = routes.size();
+            routes.push_back(seq);
+        } else if (!isValidTraceMove(rec, h.n)) {
+            problem = "an invalid move";
+        }
+        if (!problem.empty()) break;
+        records.push_back(rec);
+    }
+    fclose(in);
+    if (ok && !problem.empty()) {
+        cout << "The trace " << filename << " contains " << problem << " (record #" << records.size() << "), ignoring it." << endl;
+        ok = false;
+    }
+
+    // the first record has to be a complete route:
+    if (ok && (records.empty() || records[0].type != MOVE_ROUTE)) {
+        cout << "The trace " << filename << " does not start with a route." << endl;
+        ok = false;
+    }
+    if (!ok) { records.clear(); return false; }
+
+    position = 0;
+    applyRecord(0);
+    position = 1;
+    return true;
+}
+
+void TSPTraceReplay::applyRecord(size_t k) {
+    TSPTraceRecord & rec = records[k];
+    if (rec.type == MOVE_ROUTE) {
+        route.clear();
+        vector<int> & seq = routes[rec.i];
+        for (size_t i=0; i<seq.size(); i++) route.addStep(seq[i]);
+    } else {
+        TSPMove m = { (int)rec.type, rec.i, rec.j };
+        TSPRouteOptimizer::applyMove(&route, m, &split);
+    }
+}
+
+bool TSPTraceReplay::stepForward(void) {
+    if (position >= records.size()) return false;
+    applyRecord(position++);
+    return true;
+}
+
+bool TSPTraceReplay::stepBack(void) {
+    if (position <= 1) return false;
+    size_t target = position - 1;
+
+    // start over from the last complete route before the target, and apply the moves in between:
+    size_t k = target - 1;
+    while (records[k].type != MOVE_ROUTE) k--;
+    for (; k < target; k++) applyRecord(k);
+    position = target;
+    return true;
+}
+
+string TSPTraceReplay::describe(void) {
+    stringstream ss;
+    ss << "Replay " << position << "/" << records.size();
+    if (position > 0) {
+        TSPTraceRecord & rec = records[position - 1];
+        ss << ": " << traceMoveName(rec.type);
+        if (rec.type != MOVE_ROUTE) ss << "(" << rec.i << "," << rec.j << "), gain=" << rec.gain;
+        ss << " @" << (rec.time / 1000000.0) << "ms";
+    }
+    return ss.str();
+}
+
+#endif
@@ -0,0 +1,96 @@
+#ifndef TSP_TSPLIB
+#define TSP_TSPLIB 1
+
+#include <fstream>
+
+using namespace std;
+
+
+/////////////////////////////////////////////////////////////////////////////
+//                                                                         //
+// CLASSES AND METHODS:                                                    //
+//                                                                         //
+/////////////////////////////////////////////////////////////////////////////
+
+/**
+ * reads the coordinates of a TSPLIB file (TYPE: TSP with a NODE_COORD_SECTION,
+ * see http://comopt.ifi.uni-heidelberg.de/software/TSPLIB95/). The specification
+ * lines are kept; the coordinates are used as they are (x = first, y = second).
+ */
+class TSPLibFile {
+    protected:
+        string name;
+        string comment;
+        string edgeWeightType;
+        size_t dimension;
+        string message;
+        static string trim(const string & s);
+    public:
+        TSPLibFile() { dimension = 0; }
+        bool load(string filename, TSPPointStore & out);
+        string getName(void) { return name; }
+        string getComment(void) { return comment; }
+        string getEdgeWeightType(void) { return edgeWeightType; }
+        size_t getDimension(void) { return dimension; }
+        string getMessage(void) { return message; }
+};
+
+string TSPLibFile::trim(const string & s) {
+    size_t from = s.find_first_not_of(" \t\r");
+    if (from == string::npos) return "";
+    size_t to = s.find_last_not_of(" \t\r");
+    return s.substr(from, to - from + 1);
+}
+
+/**
+ * @return false (with a message) if the file cannot be read or has no coordinates for all nodes
+ */
+bool TSPLibFile::load(string filename, TSPPointStore & out) {
+    ifstream in(filename.c_str());
+    if (!in) { message = "Could not open " + filename; return false; }
+
+    string line;
+    bool coords = false;
+    size_t count = 0;
+    while (getline(in, line)) {
+        line = trim(line);
+        if (line.empty()) continue;
+        if (line == "EOF") break;
+        if (coords) {
+            stringstream ss(line);
+            size_t id; double x, y;
+            if (!(ss >> id >> x >> y) || id < 1 || id > dimension) {
+                message = filename + ": bad node line: " + line;
+                return false;
+            }
+            out.set(id - 1, x, y);
+            count ++;
+            continue;
+        }
+        if (line == "NODE_COORD_SECTION") {
+            if (dimension == 0) { message = filename + ": DIMENSION missing"; return false; }
+            out.resize(dimension);
+            coords = true;
+            continue;
+        }
+        size_t colon = line.find(':');
+        if (colon == string::npos) {
+            message = filename + ": unsupported section: " + line;
+            return false;
+        }
+        string key = trim(line.substr(0, colon)), value = trim(line.substr(colon + 1));
+        if (key == "NAME") name = value;
+        if (key == "COMMENT") comment = value;
+        if (key == "DIMENSION") dimension = atol(value.c_str());
+        if (key == "EDGE_WEIGHT_TYPE") edgeWeightType = value;
+        if (key == "TYPE" && value != "TSP") { message = filename + ": not a symmetric TSP: " + value; return false; }
+    }
+    if (!coords || count != dimension) {
+        message = filename + ": expected coordinates for " + to_string(dimension) + " nodes";
+        return false;
+    }
+    message = "";
+    return true;
+}
+
+#endif
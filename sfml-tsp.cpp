@@ -8,21 +8,52 @@
 #include <iostream>
 #include <sstream>
 #include <vector>
-#include <cstdlib> // for rand() and srand()
+#include <cstdlib>
 #include <cmath> // for sqrt()
 #include <SFML/Graphics.hpp>
 #include <stdio.h> // for sprintf()
+#include <ctime> // for time()
+#include <mutex>
+#include <chrono>
 
 #define TSP_N 20 // Number of desired points in the TSP model
+#define TSP_DISTRIBUTION DIST_BLOB // how the points are spread, see sfml-tsp-generator.hpp
 #define SEED_POINTS 4
 #define SEED_ROUTE 1
 
 #define FONT0 "/usr/share/fonts/truetype/dejavu/DejaVuSans.ttf"
 
+// 1: only repaint after something changed (route, hover, resize, solver progress),
+//    otherwise block in waitEvent(); 0: repaint unconditionally on every frame
+#define RENDER_ON_CHANGE 1
+#define SOLVER_PROGRESS_FPS 30 // max. repaints per second while optimizing until a local optimum
+#define MULTISTART_ROUTES 100 // local optima from random routes for the overlay (M key)
+#define MULTISTART_SECONDS 1.0 // for all of them together
+
+#include "sfml-tsp-memory.hpp"
+#include "sfml-tsp-profile.hpp"
 #include "sfml-tsp-class-declarations.hpp"
+#include "sfml-tsp-simd.hpp"
+#include "sfml-tsp-geometry.hpp"
+#include "sfml-tsp-points.hpp"
+#include "sfml-tsp-metrics.hpp"
+#include "sfml-tsp-distances.hpp"
+#include "sfml-tsp-tour.hpp"
+#include "sfml-tsp-threads.hpp"
+#include "sfml-tsp-generator.hpp"
 #include "sfml-tsp-global.hpp"
 #include "sfml-tsp-model.hpp"
+#include "sfml-tsp-checkpoint.hpp"
+#include "sfml-tsp-trace.hpp"
+#include "sfml-tsp-bounds.hpp"
+#include "sfml-tsp-small.hpp"
+#include "sfml-tsp-exact.hpp"
+#include "sfml-tsp-partition.hpp"
+#include "sfml-tsp-anytime.hpp"
 #include "sfml-tsp-analyses.hpp"
+#include "sfml-tsp-tsplib.hpp"
+#include "sfml-tsp-regress.hpp"
+#include "sfml-tsp-server.hpp"
 #include "sfml-tsp-gfx.hpp"
 
 /*
@@ -30,51 +61,352 @@ TODO:
 - starting route creation mode: inside out (spirals)
 - starting route creation mode: add points one by one (each: where it causes the least increase in route length)
   - needs: route->insertAt() (and maybe: route->removeAt())
-- iterate many SEED_ROUTEs at once.
 - add a route comparison metric: how many sections are equal in two routes (also consider reverse direction!)
 DONE:
 - key trigger: optimize all at once. (<Shift> + o)
 - optimize moveSinglePoint() (possibly eliminate creation of new "test routes")
+- iterate many SEED_ROUTEs at once (M: multi-start, shown as an overlay)
 */
 
 
+/**
+ * (re-)computes the Held-Karp lower bound, using the current route as upper bound.
+ */
+void updateLowerBound(void) {
+    lowerBound->compute(currentRoute->getLength());
+    lowerBound->updateAlphaCandidates(*candidates); // better candidates for the optimizers
+    cout << lowerBound->debug();
+    painter->invalidate();
+}
+
+/**
+ * before points are added or removed: a trace only fits one instance.
+ */
+void instanceChanging(void) {
+    if (trace != NULL) {
+        delete trace; trace = NULL;
+        cout << "Stopped recording: the instance changes." << endl;
+    }
+}
+
+/**
+ * after points have been added or removed: everything which belongs to the
+ * old instance is dropped, and the repaired route becomes the current one.
+ */
+void instanceChanged(TSPRoute * repaired) {
+    if (!repaired->isComplete()) {
+        throw new runtime_error("Repairing the route after changing the instance failed!"); exit(1);
+    }
+    routeHistory->clear();
+    checkpoint->forgetBest();
+    delete lowerBound; lowerBound = new TSPLowerBound(points, distances, candidates); // computed again on key L
+    highlightedPoint = -1;
+
+    routePool->release(currentRoute); currentRoute = NULL; // not into the history
+    setCurrentRoute(repaired);
+    cout << "Now " << points.size() << " points, l=" << repaired->getLength() << "." << endl;
+}
+
+/**
+ * adds a point at x;y. The distances, candidate lists and painter are
+ * updated incrementally; the current route gets the point by cheapest
+ * insertion (next to one of its candidates) and 2-opt around it.
+ */
+void addPoint(double x, double y) {
+    instanceChanging();
+    int id = points.size();
+    points.add(x, y);
+    distances->updatePoint(id);
+    candidates->addPoint(*distances);
+    painter->addPoint(points, id);
+
+    TSPRoute * r = currentRoute;
+    int n = r->getSize();
+    int bestPos = -1; // insert after this position
+    double bestCost = 1e300;
+    const int * c = candidates->getCandidates(id);
+    for (size_t m=0; m<candidates->getK() && c[m] >= 0; m++) {
+        int pc = r->getIndexOf(c[m]);
+        for (int p = pc - 1; p <= pc; p++) {
+            int a = r->getStep(p), b = r->getStep(p + 1);
+            double cost = distances->getDistance(a, id) + distances->getDistance(id, b) - distances->getDistance(a, b);
+            if (cost < bestCost) { bestCost = cost; bestPos = (p + n) % n; }
+        }
+    }
+
+    TSPRoute * repaired = routePool->acquire();
+    for (int i=0; i<n; i++) {
+        repaired->addStep(r->getStep(i));
+        if (i == bestPos) repaired->addStep(id);
+    }
+    deque<int> todo;
+    todo.push_back(id); todo.push_back(repaired->prev(id)); todo.push_back(repaired->next(id));
+    optimizer->twoOptAround(repaired, todo);
+    instanceChanged(repaired);
+}
+
+/**
+ * removes point p; the last point takes its ID. The route keeps its order
+ * without p, followed by 2-opt around the gap.
+ */
+void deletePoint(int p) {
+    if (points.size() <= 4) {
+        cout << "Not removing any more points." << endl;
+        return;
+    }
+    instanceChanging();
+    int last = points.size() - 1;
+    TSPRoute * r = currentRoute;
+    int n = r->getSize();
+    int pos = r->getIndexOf(p);
+    int before = r->getStep(pos - 1), after = r->getStep(pos + 1);
+    if (before == last) before = p;
+    if (after == last) after = p;
+
+    TSPRoute * repaired = routePool->acquire();
+    for (int i=1; i<n; i++) {
+        int q = r->getStep(pos + i);
+        repaired->addStep((q == last) ? p : q);
+    }
+
+    points.set(p, points.getX(last), points.getY(last));
+    points.resize(last);
+    if (p != last) distances->updatePoint(p);
+    distances->truncate(last);
+    candidates->removePoint(*distances, p);
+    painter->removePoint(p);
+
+    deque<int> todo;
+    todo.push_back(before); todo.push_back(after);
+    optimizer->twoOptAround(repaired, todo);
+    instanceChanged(repaired);
+}
+
 void init(void) {
-    srand(SEED_POINTS); // use a fixed random seed, so the point configuration becomes predictable
+    seedRandom(SEED_POINTS); // use a fixed random seed, so the point configuration becomes predictable
 
     currentRoute = NULL;
+    trace = NULL;
+    replay = NULL;
+    threadPool = new TSPThreadPool();
+    routePool = new TSPRoutePool();
+    checkpoint = new TSPCheckpoint(CHECKPOINT_FILE, CHECKPOINT_INTERVAL);
     painter = new TSPPainter();
     routeHistory = new TSPRouteHistory();
     optimizer = new TSPRouteOptimizer();
+    optimizer->setThreadPool(threadPool);
 
     // create and set up the application's data model:
     createPoints();
     painter->updatePoints(points);
 
-    routingTable = new TSPRoutingTable(points);
-    cout << routingTable->debug();
-
-    srand(SEED_ROUTE); // use a fixed random seed, so the point configuration becomes predictable
-    // setCurrentRoute(TSPRouter::naiveOrdered());
-    // setCurrentRoute(TSPRouter::naiveClosest());
-    setRandomRoute();
+    candidates = new TSPCandidateLists(points, CANDIDATES_K);
+    if (points.size() <= MATRIX_MAX_N) {
+        distances = new TSPRoutingTable(points);
+    } else {
+        // the full matrix would not fit into memory: compute on demand, cache the candidate edges
+        TSPOnTheFlyDistances * onTheFly = new TSPOnTheFlyDistances(points, points.size() * CANDIDATES_K);
+        onTheFly->prewarm(*candidates);
+        distances = onTheFly;
+    }
+    cout << candidates->debug();
+    cout << distances->debug();
+    lowerBound = new TSPLowerBound(points, distances, candidates);
+
+    seedRandom(SEED_ROUTE); // use a fixed random seed, so the point configuration becomes predictable
+
+    // continue where a previous run on the same points stopped, if possible:
+    TSPRoute * resumed = checkpoint->load(optimizer);
+    if (resumed != NULL) {
+        setCurrentRoute(resumed);
+    } else {
+        // setCurrentRoute(TSPRouter::naiveOrdered());
+        // setCurrentRoute(TSPRouter::naiveClosest());
+        setRandomRoute();
+    }
 
     cout << "Current route: " << currentRoute->describe();
+
+    if (points.size() <= BOUND_AUTO_MAX_N) updateLowerBound();
 }
 
 void destroy(void) {
     // clean up after the application:
 
+    delete trace; trace = NULL; // flushes the remaining records
+    delete replay; replay = NULL;
+
+    checkpoint->save(currentRoute, optimizer);
+    delete checkpoint; checkpoint = NULL;
+
     delete optimizer; optimizer = NULL;
     delete routeHistory; routeHistory = NULL;
     delete painter; painter = NULL;
+    routePool->release(currentRoute); currentRoute = NULL;
+    delete routePool; routePool = NULL;
 
+    delete lowerBound; lowerBound = NULL;
+    delete threadPool; threadPool = NULL;
     deletePoints(); // in sfml-tsp-model.cpp
-    deleteRoutingTable();
+    deleteDistances();
+
+    cout << memoryStats.debug(); // what is left (should be little) and the peaks
+
+#ifdef TSP_PROFILE
+    writeProfile(PROFILE_FILE);
+#endif
+}
+
+/**
+ * the end-to-end regression run, without a window (see sfml-tsp-regress.hpp).
+ * @param update write the results as the new goldens instead of comparing
+ * @param timing fail on slower runs, too (the goldens have to be from this machine)
+ * @return the exit code
+ */
+int regress(bool update, bool timing) {
+    trace = NULL;
+    threadPool = new TSPThreadPool();
+    routePool = new TSPRoutePool();
+
+    TSPRegression regression;
+    regression.setStrictTiming(timing);
+    if (!update && !regression.loadGoldens(REGRESS_GOLDENS)) {
+        cout << "No goldens in " << REGRESS_GOLDENS << " (create them with --regress-update)." << endl;
+    }
+    bool ok = regression.run();
+    if (update) ok = regression.saveGoldens(REGRESS_GOLDENS) && ok;
+    else cout << (ok ? "No regressions." : "Regressions: " + to_string(regression.getFailures())) << endl;
+
+    delete routePool; routePool = NULL;
+    delete threadPool; threadPool = NULL;
+    return ok ? 0 : 1;
+}
+
+/**
+ * the solve server, without a window (see sfml-tsp-server.hpp).
+ * @return the exit code
+ */
+int serve(void) {
+    trace = NULL;
+    threadPool = new TSPThreadPool();
+    routePool = new TSPRoutePool();
+    int result;
+    {
+        TSPServer server(SERVER_SOCKET);
+        result = server.run();
+    }
+    delete routePool; routePool = NULL;
+    delete threadPool; threadPool = NULL;
+    return result;
+}
+
+/**
+ * a stand-in client for the server: count uniform instances of n points
+ * (each one twice in a row, the second time from the server's cache),
+ * solved for the given seconds or until the given gap; or only the shutdown
+ * request ("stop").
+ * @return the exit code
+ */
+int client(int argc, char** argv) {
+    TSPServerClient c;
+    if (!c.connect(SERVER_SOCKET)) return 1;
+    if (argc > 2 && string(argv[2]) == "stop") return c.shutdown() ? 0 : 1;
+
+    int count = (argc > 2) ? atoi(argv[2]) : 10;
+    int n = (argc > 3) ? atoi(argv[3]) : 1000;
+    double seconds = (argc > 4) ? atof(argv[4]) : 0.1;
+    double targetGap = (argc > 5) ? atof(argv[5]) : 0;
+    vector<TSPPointStore> instances(count);
+    for (int k=0; k<count; k++) TSPInstanceGenerator(1 + k / 2).generate(instances[k], n, DIST_UNIFORM);
+
+    // send from a second thread, so that neither side blocks on a full socket:
+    vector<chrono::steady_clock::time_point> sent(count);
+    thread sender([&]() {
+        for (int k=0; k<count; k++) {
+            sent[k] = chrono::steady_clock::now();
+            if (!c.send(k, instances[k], seconds, METRIC_EUCLIDEAN, targetGap)) break;
+        }
+    });
+    int failures = 0;
+    for (int k=0; k<count; k++) {
+        TSPServerReply head;
+        vector<int> route;
+        if (!c.receive(head, route)) { cout << "The server has gone." << endl; failures ++; break; }
+        if ((int)head.id >= count) { cout << "Unknown reply #" << head.id << endl; failures ++; break; }
+        double latency = chrono::duration<double>(chrono::steady_clock::now() - sent[head.id]).count();
+
+        // a permutation of all points?
+        vector<char> seen(n, 0);
+        bool valid = (head.status == SERVER_OK && (int)route.size() == n);
+        for (size_t i=0; valid && i<route.size(); i++) {
+            if (route[i] < 0 || route[i] >= n || seen[route[i]]) valid = false;
+            else seen[route[i]] = 1;
+        }
+        if (!valid) failures ++;
+        printf("#%u: status %u, l=%.4f, %.4fs on the server, %.4fs round trip%s\n",
+            head.id, head.status, head.length, head.seconds, latency, valid ? "" : " INVALID");
+    }
+    sender.join();
+    cout << (failures == 0 ? "All routes valid." : "Failures: " + to_string(failures)) << endl;
+    return failures == 0 ? 0 : 1;
+}
+
+/**
+ * paints one complete frame: all points, the current route and the overlays.
+ */
+void paintFrame(sf::RenderWindow & window) {
+    TSP_ZONE("paintFrame");
+    // clear the window with black color:
+    window.clear(sf::Color::Black);
+
+    // window.draw(circle1);
+
+    // paint all points, highlight the point which is closest to the mouse pointer:
+    painter->paintPoints(&window, highlightedPoint);
+
+    // draw the current route:
+    painter->paintRoute(&window);
+
+    // internally swaps the front and back buffers:
+    window.display();
+
+    painter->markPainted();
+}
+
+/**
+ * while replaying a trace, only the replay keys are handled.
+ */
+void handleReplayKey(sf::Keyboard::Key key) {
+    bool moved = false;
+    if (key == sf::Keyboard::Right) moved = replay->stepForward();
+    if (key == sf::Keyboard::Left) moved = replay->stepBack();
+    if (key == sf::Keyboard::R || key == sf::Keyboard::Escape) {
+        // back to the live route:
+        delete replay; replay = NULL;
+        painter->setStatus("");
+        painter->updateRoute(currentRoute);
+        cout << "Replay ended." << endl;
+        return;
+    }
+    if (moved) {
+        painter->updateRoute(replay->getRoute());
+        painter->setStatus(replay->describe());
+    }
 }
 
-int main() {
+int main(int argc, char** argv) {
     // LinearEquation::testCase2(); exit(1);
 
+    // offline conversion, no window needed:
+    if (argc == 4 && string(argv[1]) == "--trace-to-jsonl") {
+        return TSPTraceLog::toJsonLines(argv[2], argv[3]) ? 0 : 1;
+    }
+    if (argc == 2 && (string(argv[1]) == "--regress" || string(argv[1]) == "--regress-update" || string(argv[1]) == "--regress-timing")) {
+        return regress(string(argv[1]) == "--regress-update", string(argv[1]) == "--regress-timing");
+    }
+    if (argc == 2 && string(argv[1]) == "--serve") return serve();
+    if (argc >= 2 && string(argv[1]) == "--client") return client(argc, argv);
+
     sf::ContextSettings settings;
     settings.antialiasingLevel = 8;
 
@@ -99,13 +431,23 @@ int main() {
 
     while (window.isOpen()) {
         sf::Event event;
-        while (window.pollEvent(event)) {
+        bool hasEvent = window.pollEvent(event);
+#if RENDER_ON_CHANGE
+        // nothing to do and nothing to repaint - sleep until the next event arrives:
+        if (!hasEvent && !painter->isDirty()) hasEvent = window.waitEvent(event);
+#endif
+        while (hasEvent) {
+            TSP_ZONE("handleEvent");
             switch (event.type) {
                 case sf::Event::Resized:
                     std::cout << "new width: " << event.size.width << ", new height: " << event.size.height << std::endl;
                     painter->setCanvas(0,0,event.size.width, event.size.height);
                     break;
 
+                case sf::Event::GainedFocus:
+                    painter->invalidate(); // the window content might have been damaged
+                    break;
+
                 // window closed
                 case sf::Event::Closed:
                     window.close();
@@ -115,6 +457,10 @@ int main() {
                 // key pressed
                 case sf::Event::KeyPressed:
                     // std::cout << "key pressed: " << event.key.code << std::endl;
+                    if (replay != NULL) {
+                        handleReplayKey(event.key.code);
+                        break;
+                    }
                     if (event.key.code == sf::Keyboard::Space) {
                         setRandomRoute();
                     }
@@ -124,18 +470,120 @@ int main() {
                     		|| sf::Keyboard::isKeyPressed(sf::Keyboard::RShift);
                     	if (complete) cout << "Optimizing until reaching local optimum..." << endl;
 
+                    	sf::Clock progressClock;
                     	TSPRoute * candidate;
                     	do {
 							candidate = optimizer->optimizeStep(currentRoute);
 
 							if (candidate != NULL) {
 								cout << optimizer->getLastMessage() << endl;
-								setCurrentRoute(candidate);
+								setCurrentRoute(candidate, true);
+								checkpoint->saveIfDue(currentRoute, optimizer);
+
+								// close enough to the lower bound - no need to go on (not with an estimate of it):
+								double gap = lowerBound->getGap(currentRoute->getLength());
+								if (complete && lowerBound->isExact() && gap >= 0 && gap <= TARGET_GAP) {
+									cout << "Within " << (gap * 100) << "% of the lower bound, stopping." << endl;
+									break;
+								}
+
+								// solver progress: show the intermediate route now and then
+								if (complete && progressClock.getElapsedTime().asSeconds() > 1.0 / SOLVER_PROGRESS_FPS) {
+									paintFrame(window);
+									progressClock.restart();
+								}
 							}
 
 							// only loop if Shift was pressed at call time:
 							if (!complete) break;
                     	} while (candidate != NULL);
+                    	if (complete) cout << optimizer->getScheduler().debug() << memoryStats.debug();
+                    }
+                    if (event.key.code == sf::Keyboard::A) {
+                        // improve the current route within a fixed time (Shift: ten times as long):
+                        bool longer =
+                            sf::Keyboard::isKeyPressed(sf::Keyboard::LShift)
+                            || sf::Keyboard::isKeyPressed(sf::Keyboard::RShift);
+                        double seconds = ANYTIME_SECONDS * (longer ? 10 : 1);
+                        cout << "Optimizing for " << seconds << "s..." << endl;
+
+                        sf::Clock progressClock;
+                        TSPAnytimeSolver solver(optimizer, threadPool, nextRandom());
+                        if (lowerBound->isExact() && lowerBound->getBound() > 0) solver.setTarget(lowerBound->getBound() * (1 + TARGET_GAP));
+                        TSPRoute * best = solver.solve(currentRoute, seconds, -1, [&](TSPRoute * r, double) {
+                            // solver progress: show the best route now and then
+                            if (progressClock.getElapsedTime().asSeconds() > 1.0 / SOLVER_PROGRESS_FPS) {
+                                painter->updateRoute(r);
+                                paintFrame(window);
+                                progressClock.restart();
+                            }
+                        });
+                        cout << solver.getMessage() << endl;
+                        if (best->getLength() < currentRoute->getLength()) {
+                            setCurrentRoute(best);
+                            checkpoint->saveIfDue(currentRoute, optimizer);
+                        } else {
+                            routePool->release(best);
+                            painter->updateRoute(currentRoute);
+                        }
+                    }
+                    if (event.key.code == sf::Keyboard::M) {
+                        // multi-start: many local optima from random routes, all shown at once (M again: hide them)
+                        if (painter->hasOverlay()) {
+                            painter->clearOverlay();
+                        } else {
+                            cout << "Optimizing " << MULTISTART_ROUTES << " random routes..." << endl;
+                            TSPRouteOptimizer opt;
+                            opt.setThreadPool(threadPool);
+                            vector<TSPRoute *> routes;
+                            for (int k=0; k<MULTISTART_ROUTES; k++) {
+                                TSPAnytimeSolver solver(&opt, threadPool, nextRandom());
+                                solver.setConstruction(CONSTRUCT_RANDOM);
+                                routes.push_back(solver.solve(NULL, MULTISTART_SECONDS / MULTISTART_ROUTES));
+                            }
+                            painter->setOverlay(routes);
+
+                            size_t best = 0;
+                            for (size_t k=1; k<routes.size(); k++) if (routes[k]->getLength() < routes[best]->getLength()) best = k;
+                            cout << "Best of them: " << routes[best]->getLength() << endl;
+                            if (routes[best]->getLength() < currentRoute->getLength()) {
+                                setCurrentRoute(routes[best]);
+                                routes[best] = NULL;
+                            }
+                            for (size_t k=0; k<routes.size(); k++) routePool->release(routes[k]);
+                        }
+                    }
+                    if (event.key.code == sf::Keyboard::E) {
+                        // solve exactly (only feasible for few points):
+                        cout << "Solving exactly..." << endl;
+                        TSPExactSolver solver(points);
+                        TSPRoute * exact = solver.solve(currentRoute);
+                        cout << solver.getMessage() << endl;
+                        if (exact != NULL && exact->getLength() < currentRoute->getLength()) {
+                            setCurrentRoute(exact);
+                        } else if (exact != NULL) {
+                            routePool->release(exact);
+                        }
+                    }
+                    if (event.key.code == sf::Keyboard::P) {
+                        // solve cell by cell (for many points):
+                        cout << "Solving by spatial partitioning..." << endl;
+                        TSPPartitionSolver solver(points, threadPool);
+                        TSPRoute * partitioned = solver.solve();
+                        cout << solver.getMessage() << endl;
+                        setCurrentRoute(partitioned);
+                    }
+                    if (event.key.code == sf::Keyboard::Delete && highlightedPoint >= 0) {
+                        // remove the point under the mouse:
+                        deletePoint(highlightedPoint);
+                    }
+                    if (event.key.code == sf::Keyboard::L) {
+                        // compute / refine the lower bound (slow for many points):
+                        updateLowerBound();
+                    }
+                    if (event.key.code == sf::Keyboard::K) {
+                        // save a checkpoint right now:
+                        if (checkpoint->save(currentRoute, optimizer)) cout << "Checkpoint saved." << endl;
                     }
                     if (event.key.code == sf::Keyboard::B) {
                         // one step back in the route history:
@@ -143,8 +591,60 @@ int main() {
                     }
                     if (event.key.code == sf::Keyboard::I) {
                     	cout << "Finding intersections on the current route... " << endl;
-                    	bool result = TSPRouteAnalyzer::findIntersections(currentRoute);
-                    	if (!result) cout << "   ... none found." << endl;
+                    	TSPSplitRoute split;
+                    	bool result = TSPRouteAnalyzer::findIntersections(currentRoute, &split, threadPool);
+                    	if (!result) {
+                    		cout << "   ... none found." << endl;
+                    	} else {
+                    		TSPRoute * untangled = routePool->acquire();
+                    		split.joinInto(untangled);
+                    		cout << "   ... most savings (" << (currentRoute->getLength() - untangled->getLength()) << ") ";
+                    		cout << "by reconnecting after positions " << split.getSplitA() << " and " << split.getSplitB() << "." << endl;
+                    		routePool->release(untangled);
+                    	}
+                    }
+                    if (event.key.code == sf::Keyboard::X) {
+                        // show / hide all crossings of the route:
+                        painter->toggleCrossings();
+                    }
+                    if (event.key.code == sf::Keyboard::U) {
+                        // remove all crossings at once:
+                        TSPRoute * untangled = optimizer->untangleAll(currentRoute);
+                        if (untangled != NULL) {
+                            cout << optimizer->getLastMessage();
+                            setCurrentRoute(untangled, true);
+                        }
+                    }
+                    if (event.key.code == sf::Keyboard::Z) {
+                        // dump the timing zones (only with -DTSP_PROFILE):
+                        writeProfile(PROFILE_FILE);
+                    }
+                    if (event.key.code == sf::Keyboard::T) {
+                        // start / stop recording all applied moves:
+                        if (trace == NULL) {
+                            trace = new TSPTraceLog(TRACE_FILE);
+                            if (trace->isOpen()) {
+                                trace->recordRoute(currentRoute);
+                                cout << "Recording trace to " << TRACE_FILE << endl;
+                            } else {
+                                delete trace; trace = NULL;
+                            }
+                        } else {
+                            delete trace; trace = NULL;
+                            cout << "Trace saved to " << TRACE_FILE << endl;
+                        }
+                    }
+                    if (event.key.code == sf::Keyboard::R) {
+                        // replay the last recorded trace, step by step with the arrow keys:
+                        if (trace != NULL) { delete trace; trace = NULL; } // make sure everything is on disk
+                        replay = new TSPTraceReplay();
+                        if (replay->load(TRACE_FILE)) {
+                            cout << "Replaying " << TRACE_FILE << " (<Left>/<Right>: step, R: end)" << endl;
+                            painter->updateRoute(replay->getRoute());
+                            painter->setStatus(replay->describe());
+                        } else {
+                            delete replay; replay = NULL;
+                        }
                     }
                     break;
 
@@ -160,19 +660,29 @@ int main() {
                 case sf::Event::MouseMoved:
                     currentMouseX = event.mouseMove.x;
                     currentMouseY = event.mouseMove.y;
-                    highlightedPoint = routingTable->findClosestPointIdx(
-                        painter->px2x(currentMouseX),
-                        painter->py2y(currentMouseY)
-                    );
+                    {
+                        int closest = points.findClosest(
+                            painter->px2x(currentMouseX),
+                            painter->py2y(currentMouseY)
+                        );
+                        if (closest != highlightedPoint) {
+                            highlightedPoint = closest;
+                            painter->invalidate(); // hover change
+                        }
+                    }
                     break;
 
                 case sf::Event::MouseButtonPressed:
+                    if (event.mouseButton.button == sf::Mouse::Left && replay == NULL) {
+                        // add a point here:
+                        addPoint(painter->px2x(event.mouseButton.x), painter->py2y(event.mouseButton.y));
+                    }
                     if (event.mouseButton.button == sf::Mouse::Right) {
                     	int x = event.mouseButton.x;
                     	int y = event.mouseButton.y;
                     	cout << "the right button was pressed @(";
                         cout << x << ";" << y << "); closest point #";
-                        int pointIdx = routingTable->findClosestPointIdx(painter->px2x(x), painter->py2y(y));
+                        int pointIdx = points.findClosest(painter->px2x(x), painter->py2y(y));
                         cout << pointIdx << " at position ";
                         cout << currentRoute->getIndexOf(pointIdx);
                         cout << " of the route." << endl;
@@ -188,22 +698,17 @@ int main() {
                 // we don't process other types of events
                 default: break;
             }
-        }
-
-        // clear the window with black color:
-        window.clear(sf::Color::Black);
 
-        // window.draw(circle1);
-
-        // paint all points, highlight the point which is closest to the mouse pointer:
-        painter->paintPoints(&window, highlightedPoint);
-
-        // draw the current route:
-        painter->paintRoute(&window);
+            hasEvent = window.pollEvent(event);
+        }
 
-        // internally swaps the front and back buffers:
-        window.display();
+        // the window might have been closed (and the painter destroyed) meanwhile:
+        if (!window.isOpen()) break;
 
+#if RENDER_ON_CHANGE
+        if (!painter->isDirty()) continue;
+#endif
+        paintFrame(window);
     }
 
     return 0;